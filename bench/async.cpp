@@ -0,0 +1,101 @@
+#include "bench.h"
+#include <ssh/async.h>
+#include <ssh/context.h>
+#include <thread>
+#include <vector>
+
+namespace bench {
+namespace {
+
+constexpr std::size_t iterations = 1000000;
+
+ssh::async<std::size_t> value(std::size_t value) {
+  co_return value;
+}
+
+ssh::async<std::size_t> sum(std::size_t count) {
+  std::size_t sum = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    sum += co_await value(i);
+  }
+  co_return sum;
+}
+
+ssh::async_generator<std::size_t> sequence(std::size_t count) {
+  for (std::size_t i = 0; i < count; i++) {
+    co_yield i;
+  }
+}
+
+ssh::async<std::size_t> iterate(std::size_t count) {
+  std::size_t sum = 0;
+  auto generator = sequence(count);
+  for (auto it = co_await generator.begin(); it != generator.end(); co_await ++it) {
+    sum += *it;
+  }
+  co_return sum;
+}
+
+ssh::async<std::size_t> lock(ssh::async_mutex& mutex, std::size_t count) {
+  std::size_t sum = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    auto lock = co_await mutex.scoped_lock_async();
+    sum++;
+  }
+  co_return sum;
+}
+
+// Holds the lock across a reschedule, so that every other coroutine queues on the mutex.
+ssh::task contend(ssh::context& context, ssh::async_mutex& mutex, std::size_t count, std::atomic_size_t& running) {
+  for (std::size_t i = 0; i < count; i++) {
+    auto lock = co_await mutex.scoped_lock_async();
+    co_await context.schedule();
+  }
+  if (running.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    context.stop();
+  }
+}
+
+}  // namespace
+
+void async() {
+  measure("async/create_await_destroy", 1, iterations, []() {
+    auto result = sum(iterations);
+    (void)result;
+  });
+
+  measure("async_generator/iterate", 1, iterations, []() {
+    auto result = iterate(iterations);
+    (void)result;
+  });
+
+  measure("async_mutex/uncontended", 1, iterations, []() {
+    ssh::async_mutex mutex;
+    auto result = lock(mutex, iterations);
+    (void)result;
+  });
+
+  const auto concurrency = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t threads = 1; threads <= concurrency; threads *= 2) {
+    constexpr std::size_t coroutines = 64;
+    constexpr std::size_t count = iterations / coroutines / 4;
+    measure("async_mutex/contended", threads, coroutines * count, [threads]() {
+      ssh::context context;
+      ssh::async_mutex mutex;
+      std::atomic_size_t running = coroutines;
+      for (std::size_t i = 0; i < coroutines; i++) {
+        contend(context, mutex, count, running);
+      }
+      std::vector<std::thread> workers;
+      for (std::size_t i = 1; i < threads; i++) {
+        workers.emplace_back([&]() { context.run(); });
+      }
+      context.run();
+      for (auto& worker : workers) {
+        worker.join();
+      }
+    });
+  }
+}
+
+}  // namespace bench
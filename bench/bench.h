@@ -0,0 +1,32 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <cstddef>
+
+namespace bench {
+
+using clock = std::chrono::steady_clock;
+
+// Returns true when the benchmark matches the filter given on the command line.
+bool enabled(const std::string& name);
+
+// Prints one result as a JSON object per line.
+void report(const std::string& name, std::size_t threads, std::size_t iterations, clock::duration duration);
+
+// Measures the callable and reports the result when the benchmark is enabled.
+template <typename Function>
+void measure(const std::string& name, std::size_t threads, std::size_t iterations, Function function) {
+  if (!enabled(name)) {
+    return;
+  }
+  const auto tp0 = clock::now();
+  function();
+  const auto tp1 = clock::now();
+  report(name, threads, iterations, tp1 - tp0);
+}
+
+void async();
+void context();
+void event();
+
+}  // namespace bench
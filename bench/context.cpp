@@ -0,0 +1,110 @@
+#include "bench.h"
+#include <ssh/context.h>
+#include <ssh/event.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace bench {
+namespace {
+
+constexpr std::size_t iterations = 1000000;
+
+ssh::task yield(ssh::context& context, std::size_t count, std::atomic_size_t& running) {
+  for (std::size_t i = 0; i < count; i++) {
+    co_await context.schedule();
+  }
+  if (running.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    context.stop();
+  }
+}
+
+ssh::async<void> write(ssh::registration& registration, char c) {
+  while (::write(registration.fd(), &c, 1) < 0 && errno == EAGAIN) {
+    registration.send().clear();
+    co_await registration.send();
+  }
+}
+
+ssh::async<void> read(ssh::registration& registration, char& c) {
+  while (::read(registration.fd(), &c, 1) < 0 && errno == EAGAIN) {
+    registration.recv().clear();
+    co_await registration.recv();
+  }
+}
+
+ssh::task echo(ssh::context& context, int fd, bool initiator, std::size_t count, std::atomic_size_t& running) {
+  ssh::registration registration(context, fd);
+  char c = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    if (initiator) {
+      co_await write(registration, c);
+    }
+    co_await read(registration, c);
+    if (!initiator) {
+      co_await write(registration, c);
+    }
+  }
+  if (running.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    context.stop();
+  }
+}
+
+void run(ssh::context& context, std::size_t threads) {
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < threads; i++) {
+    workers.emplace_back([&]() { context.run(16); });
+  }
+  context.run(16);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+}  // namespace
+
+void context() {
+  const auto concurrency = std::max(1u, std::thread::hardware_concurrency());
+
+  for (std::size_t threads = 1; threads <= concurrency; threads *= 2) {
+    constexpr std::size_t coroutines = 64;
+    measure("context/schedule", threads, iterations, [threads]() {
+      ssh::context context;
+      std::atomic_size_t running = coroutines;
+      for (std::size_t i = 0; i < coroutines; i++) {
+        yield(context, iterations / coroutines, running);
+      }
+      run(context, threads);
+    });
+  }
+
+  // Round trips over many socket pairs to measure dispatch throughput of run().
+  for (std::size_t threads = 1; threads <= concurrency; threads *= 2) {
+    constexpr std::size_t pairs = 64;
+    constexpr std::size_t count = iterations / pairs / 10;
+    std::vector<ssh::handle> handles;
+    for (std::size_t i = 0; i < pairs; i++) {
+      int fds[2] = {};
+      if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+        std::perror("socketpair");
+        return;
+      }
+      handles.emplace_back(fds[0]);
+      handles.emplace_back(fds[1]);
+    }
+    measure("context/run", threads, pairs * count, [&handles, threads]() {
+      ssh::context context;
+      std::atomic_size_t running = handles.size();
+      for (std::size_t i = 0; i < handles.size(); i++) {
+        echo(context, handles[i].value(), i % 2 == 0, count, running);
+      }
+      run(context, threads);
+    });
+  }
+}
+
+}  // namespace bench
@@ -0,0 +1,90 @@
+#include "bench.h"
+#include <ssh/context.h>
+#include <ssh/event.h>
+#include <cerrno>
+#include <cstdio>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace bench {
+namespace {
+
+constexpr std::size_t iterations = 100000;
+
+// Registers the descriptor on every await and removes it on every wakeup.
+ssh::task echo_oneshot(ssh::context& context, int fd, bool initiator) {
+  char c = 0;
+  for (std::size_t i = 0; i < iterations; i++) {
+    if (initiator) {
+      co_await ssh::event(context.handle().value(), fd, SSH_EVENT_SEND);
+      ::write(fd, &c, 1);
+    }
+    co_await ssh::event(context.handle().value(), fd, SSH_EVENT_RECV);
+    ::read(fd, &c, 1);
+    if (!initiator) {
+      co_await ssh::event(context.handle().value(), fd, SSH_EVENT_SEND);
+      ::write(fd, &c, 1);
+    }
+  }
+  if (initiator) {
+    context.stop();
+  }
+}
+
+ssh::async<void> write(ssh::registration& registration, char c) {
+  while (::write(registration.fd(), &c, 1) < 0 && errno == EAGAIN) {
+    registration.send().clear();
+    co_await registration.send();
+  }
+}
+
+ssh::async<void> read(ssh::registration& registration, char& c) {
+  while (::read(registration.fd(), &c, 1) < 0 && errno == EAGAIN) {
+    registration.recv().clear();
+    co_await registration.recv();
+  }
+}
+
+// Registers the descriptor once and awaits cached edge-triggered readiness.
+ssh::task echo_registration(ssh::context& context, int fd, bool initiator) {
+  ssh::registration registration(context, fd);
+  char c = 0;
+  for (std::size_t i = 0; i < iterations; i++) {
+    if (initiator) {
+      co_await write(registration, c);
+    }
+    co_await read(registration, c);
+    if (!initiator) {
+      co_await write(registration, c);
+    }
+  }
+  if (initiator) {
+    context.stop();
+  }
+}
+
+template <typename Echo>
+void run(const char* name, Echo echo) {
+  int fds[2] = {};
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+    std::perror("socketpair");
+    return;
+  }
+  const ssh::handle client(fds[0]);
+  const ssh::handle server(fds[1]);
+  measure(name, 1, iterations, [&]() {
+    ssh::context context;
+    echo(context, server.value(), false);
+    echo(context, client.value(), true);
+    context.run(16);
+  });
+}
+
+}  // namespace
+
+void event() {
+  run("event/add_del", echo_oneshot);
+  run("event/registration", echo_registration);
+}
+
+}  // namespace bench
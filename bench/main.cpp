@@ -0,0 +1,35 @@
+#include "bench.h"
+#include <cstdio>
+
+namespace bench {
+namespace {
+
+const char* g_filter = nullptr;
+
+}  // namespace
+
+bool enabled(const std::string& name) {
+  return !g_filter || name.find(g_filter) != std::string::npos;
+}
+
+void report(const std::string& name, std::size_t threads, std::size_t iterations, clock::duration duration) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  const auto op = iterations ? static_cast<double>(ns) / static_cast<double>(iterations) : 0.0;
+  std::printf(R"({"name":"%s","threads":%zu,"iterations":%zu,"ns":%lld,"ns_per_op":%.2f})"
+              "\n",
+    name.data(), threads, iterations, static_cast<long long>(ns), op);
+  std::fflush(stdout);
+}
+
+}  // namespace bench
+
+// Usage: bench [filter]
+// Runs all benchmarks whose name contains the filter and prints one JSON object per line.
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    bench::g_filter = argv[1];
+  }
+  bench::async();
+  bench::context();
+  bench::event();
+}
@@ -21,29 +21,385 @@
 #pragma once
 #include <ssh/config.h>
 #include <ssh/exception.h>
+#include <ssh/result.h>
+#include <algorithm>
 #include <atomic>
 #include <exception>
 #include <functional>
 #include <iterator>
-#include <mutex>
+#include <limits>
+#include <optional>
 #include <utility>
 #include <type_traits>
+#include <vector>
 #include <stdexcept>
 #include <string>
+#include <tuple>
+#include <typeinfo>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
-#include <cstdio>
 #include <experimental/coroutine>
+#include <new>
 
 namespace ssh {
 
 using std::experimental::coroutine_handle;
+using std::experimental::noop_coroutine;
 using std::experimental::suspend_always;
 using std::experimental::suspend_never;
 
+// == ssh/detail/atomic ===============================================================================================
+
+namespace detail {
+
+#if SSH_SINGLE_THREADED
+
+// Plain value with the interface of std::atomic for state that is only accessed by one thread.
+// Compare and exchange loops over it run once, so lock-free waiter lists become plain intrusive lists.
+template <typename T>
+class atomic {
+public:
+  constexpr atomic() noexcept = default;
+
+  constexpr atomic(T value) noexcept : m_value(value) {
+  }
+
+  atomic(const atomic& other) = delete;
+  atomic& operator=(const atomic& other) = delete;
+
+  T load(std::memory_order = std::memory_order_seq_cst) const noexcept {
+    return m_value;
+  }
+
+  void store(T value, std::memory_order = std::memory_order_seq_cst) noexcept {
+    m_value = value;
+  }
+
+  T exchange(T value, std::memory_order = std::memory_order_seq_cst) noexcept {
+    return std::exchange(m_value, value);
+  }
+
+  bool compare_exchange_strong(T& expected, T desired, std::memory_order = std::memory_order_seq_cst) noexcept {
+    if (m_value != expected) {
+      expected = m_value;
+      return false;
+    }
+    m_value = desired;
+    return true;
+  }
+
+  bool compare_exchange_strong(T& expected, T desired, std::memory_order, std::memory_order) noexcept {
+    return compare_exchange_strong(expected, desired);
+  }
+
+  bool compare_exchange_weak(T& expected, T desired, std::memory_order = std::memory_order_seq_cst) noexcept {
+    return compare_exchange_strong(expected, desired);
+  }
+
+  bool compare_exchange_weak(T& expected, T desired, std::memory_order, std::memory_order) noexcept {
+    return compare_exchange_strong(expected, desired);
+  }
+
+  T fetch_add(T value, std::memory_order = std::memory_order_seq_cst) noexcept {
+    return std::exchange(m_value, static_cast<T>(m_value + value));
+  }
+
+  T fetch_sub(T value, std::memory_order = std::memory_order_seq_cst) noexcept {
+    return std::exchange(m_value, static_cast<T>(m_value - value));
+  }
+
+  T fetch_or(T value, std::memory_order = std::memory_order_seq_cst) noexcept {
+    return std::exchange(m_value, static_cast<T>(m_value | value));
+  }
+
+  T fetch_and(T value, std::memory_order = std::memory_order_seq_cst) noexcept {
+    return std::exchange(m_value, static_cast<T>(m_value & value));
+  }
+
+private:
+  T m_value{};
+};
+
+#else
+
+template <typename T>
+using atomic = std::atomic<T>;
+
+#endif
+
+}  // namespace detail
+
+// == ssh/frame_allocator =============================================================================================
+
+// Allocator for the coroutine frames of task, async, async_generator and generator.
+// The allocator that allocated a frame also deallocates it, on whatever thread the frame is destroyed.
+class frame_allocator {
+public:
+  virtual ~frame_allocator() = default;
+  virtual void* allocate(std::size_t size) = 0;
+  virtual void deallocate(void* data, std::size_t size) noexcept = 0;
+};
+
+namespace detail {
+
+// Default frame allocator with a free list per size class and thread.
+// Frames destroyed on another thread are pushed to a lock-free list of the allocating thread and
+// reclaimed by it. The pool is deleted when its thread exited and the last frame was returned.
+class frame_pool final : public frame_allocator {
+public:
+  constexpr static std::size_t granularity = 64;
+  constexpr static std::size_t classes = 32;
+  constexpr static std::size_t capacity = 256;
+
+  frame_pool(const frame_pool& other) = delete;
+  frame_pool& operator=(const frame_pool& other) = delete;
+
+  void* allocate(std::size_t size) override {
+    const auto index = (size - 1) / granularity;
+    if (index >= classes) {
+      return ::operator new(size);
+    }
+    auto& list = m_lists[index];
+    if (!list.head) {
+      reclaim();
+    }
+    if (const auto block = list.head) {
+      list.head = block->next;
+      list.size--;
+      return block;
+    }
+    const auto data = ::operator new((index + 1) * granularity);
+    m_blocks++;
+    return data;
+  }
+
+  void deallocate(void* data, std::size_t size) noexcept override {
+    const auto index = (size - 1) / granularity;
+    if (index >= classes) {
+      ::operator delete(data);
+      return;
+    }
+    const auto block = new (data) node{ nullptr, index };
+    if (current() == this) {
+      push(block);
+      return;
+    }
+    auto head = m_remote.load(std::memory_order_relaxed);
+    do {
+      if (head == closed()) {
+        ::operator delete(data);
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          delete this;
+        }
+        return;
+      }
+      block->next = head;
+    } while (!m_remote.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  // Returns the pool of the calling thread and creates it when necessary.
+  static frame_pool& local() {
+    thread_local owner owner;
+    return *owner.pool;
+  }
+
+private:
+  struct node {
+    node* next;
+    std::size_t index;
+  };
+
+  struct list {
+    node* head = nullptr;
+    std::size_t size = 0;
+  };
+
+  struct owner {
+    owner() : pool(new frame_pool()) {
+      current() = pool;
+    }
+
+    ~owner() {
+      current() = nullptr;
+      pool->close();
+    }
+
+    frame_pool* pool;
+  };
+
+  frame_pool() noexcept = default;
+  ~frame_pool() = default;
+
+  static frame_pool*& current() noexcept {
+    thread_local frame_pool* pool = nullptr;
+    return pool;
+  }
+
+  static node* closed() noexcept {
+    return reinterpret_cast<node*>(std::uintptr_t(1));
+  }
+
+  void push(node* block) noexcept {
+    auto& list = m_lists[block->index];
+    if (list.size < capacity) {
+      block->next = list.head;
+      list.head = block;
+      list.size++;
+    } else {
+      ::operator delete(block);
+      m_blocks--;
+    }
+  }
+
+  // Moves frames that were destroyed on other threads to the free lists.
+  void reclaim() noexcept {
+    auto block = m_remote.exchange(nullptr, std::memory_order_acquire);
+    while (block) {
+      push(std::exchange(block, block->next));
+    }
+  }
+
+  void close() noexcept {
+    auto outstanding = static_cast<std::ptrdiff_t>(m_blocks);
+    for (auto& list : m_lists) {
+      while (list.head) {
+        ::operator delete(std::exchange(list.head, list.head->next));
+        outstanding--;
+      }
+    }
+    auto block = m_remote.exchange(closed(), std::memory_order_acquire);
+    while (block) {
+      ::operator delete(std::exchange(block, block->next));
+      outstanding--;
+    }
+    if (m_remaining.fetch_add(outstanding, std::memory_order_acq_rel) + outstanding == 0) {
+      delete this;
+    }
+  }
+
+  list m_lists[classes];
+  std::size_t m_blocks = 0;
+  std::atomic<node*> m_remote = nullptr;
+  std::atomic<std::ptrdiff_t> m_remaining = 0;
+};
+
+inline frame_allocator*& current_frame_allocator() noexcept {
+  thread_local frame_allocator* allocator = nullptr;
+  return allocator;
+}
+
+// Base class of promise types that allocates coroutine frames with the frame allocator of the calling thread.
+// The allocator is stored in front of the frame.
+class frame {
+public:
+  constexpr static std::size_t header = alignof(std::max_align_t);
+
+  static void* operator new(std::size_t size) {
+    auto allocator = current_frame_allocator();
+    if (!allocator) {
+      allocator = &frame_pool::local();
+    }
+    const auto data = static_cast<char*>(allocator->allocate(size + header));
+    *reinterpret_cast<frame_allocator**>(data) = allocator;
+    return data + header;
+  }
+
+  static void operator delete(void* data, std::size_t size) noexcept {
+    const auto block = static_cast<char*>(data) - header;
+    (*reinterpret_cast<frame_allocator**>(block))->deallocate(block, size + header);
+  }
+};
+
+}  // namespace detail
+
+// Sets the frame allocator of the calling thread and returns the previous one.
+// A null pointer selects the default per-thread pool. The allocator must outlive all frames it allocated.
+inline frame_allocator* set_frame_allocator(frame_allocator* allocator) noexcept {
+  return std::exchange(detail::current_frame_allocator(), allocator);
+}
+
+// == ssh/failure =====================================================================================================
+
+// Exception that escaped a detached task.
+struct failure {
+  // Type of the exception or nullptr when it is not derived from std::exception.
+  const std::type_info* type = nullptr;
+
+  std::string message;
+
+  // Address of the coroutine frame, which is destroyed after the failure was recorded.
+  const void* task = nullptr;
+};
+
+// Returns a line with the task address, the demangled exception type and the message.
+std::string format(const ssh::failure& failure);
+
+namespace detail {
+
+struct failure_node {
+  ssh::failure failure;
+  failure_node* next = nullptr;
+};
+
+// Lock-free queue of failures. Pushing never blocks.
+class failure_queue {
+public:
+  failure_queue() noexcept = default;
+
+  failure_queue(const failure_queue& other) = delete;
+  failure_queue& operator=(const failure_queue& other) = delete;
+
+  ~failure_queue() {
+    for (auto node = pop(); node;) {
+      delete std::exchange(node, node->next);
+    }
+  }
+
+  void push(failure_node* node) noexcept {
+    auto head = m_head.load(std::memory_order_relaxed);
+    do {
+      node->next = head;
+    } while (!m_head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  // Removes all failures and returns them in the order they were pushed.
+  failure_node* pop() noexcept {
+    failure_node* list = nullptr;
+    for (auto head = m_head.exchange(nullptr, std::memory_order_acquire); head;) {
+      list = std::exchange(head, std::exchange(head->next, list));
+    }
+    return list;
+  }
+
+  bool empty() const noexcept {
+    return m_head.load(std::memory_order_relaxed) == nullptr;
+  }
+
+private:
+  std::atomic<failure_node*> m_head = nullptr;
+};
+
+// Queue of the context that the calling thread runs.
+inline failure_queue*& current_failure_queue() noexcept {
+  thread_local failure_queue* queue = nullptr;
+  return queue;
+}
+
+// Records the current exception in the queue of the calling thread. Without one, the failure
+// is passed to the background reporter.
+void report(const void* task) noexcept;
+
+// Writes the failures to stderr on a background thread and deletes them.
+void report(failure_node* failures) noexcept;
+
+}  // namespace detail
+
+// == ssh/task ========================================================================================================
+
 class task {
 public:
-  struct promise_type {
+  struct promise_type : detail::frame {
     task get_return_object() noexcept {
       return {};
     }
@@ -59,24 +415,9 @@ public:
     constexpr void return_void() noexcept {
     }
 
-    void unhandled_exception() {
-      std::string message;
-      //try {
-      //  std::rethrow_exception(std::current_exception());
-      //}
-      //catch (const ssh::domain_error& e) {
-      //}
-      //catch (const ssh::system_error& e) {
-      //}
-      //catch (const std::domain_error& e) {
-      //}
-      //catch (const std::system_error& e) {
-      //}
-      //catch (const std::exception& e) {
-      //}
-      static std::mutex mutex;
-      std::lock_guard<std::mutex> lock(mutex);
-      std::puts(message.data());
+    // Exceptions are queued without locks and reported by the context of the thread. See context::set.
+    void unhandled_exception() noexcept {
+      detail::report(coroutine_handle<promise_type>::from_promise(*this).address());
     }
   };
 };
@@ -95,7 +436,8 @@ namespace detail {
 
 class continuation {
 public:
-  using callback_t = void(void*);
+  // Returns the coroutine to resume next or noop_coroutine().
+  using callback_t = coroutine_handle<>(void*);
 
   continuation() noexcept = default;
 
@@ -113,8 +455,17 @@ public:
     if (m_callback == nullptr) {
       coroutine_handle<>::from_address(m_state).resume();
     } else {
-      m_callback(m_state);
+      m_callback(m_state).resume();
+    }
+  }
+
+  // Returns the coroutine to transfer to from await_suspend. Callbacks are called inline and the coroutine
+  // they return is transferred to, so that completing a chain of tasks does not nest stack frames.
+  coroutine_handle<> transfer() noexcept {
+    if (m_callback == nullptr) {
+      return coroutine_handle<>::from_address(m_state);
     }
+    return m_callback(m_state);
   }
 
 private:
@@ -131,7 +482,7 @@ class async;
 
 namespace detail {
 
-class async_promise_base {
+class async_promise_base : public frame {
 public:
   async_promise_base() noexcept = default;
 
@@ -150,12 +501,15 @@ public:
         return m_promise.m_state.load(std::memory_order_acquire) == state::consumer_detached;
       }
 
-      bool await_suspend(coroutine_handle<>) noexcept {
+      coroutine_handle<> await_suspend(coroutine_handle<> coroutine) noexcept {
         state oldState = m_promise.m_state.exchange(state::finished, std::memory_order_acq_rel);
         if (oldState == state::consumer_suspended) {
-          m_promise.m_continuation.resume();
+          return m_promise.m_continuation.transfer();
+        }
+        if (oldState == state::consumer_detached) {
+          coroutine.destroy();
         }
-        return oldState != state::consumer_detached;
+        return noop_coroutine();
       }
 
       constexpr void await_resume() noexcept {
@@ -185,6 +539,12 @@ public:
     return m_state.compare_exchange_strong(oldState, state::consumer_suspended, std::memory_order_release, std::memory_order_acquire);
   }
 
+  // Removes the continuation registered by try_await. Returns false when it is already being resumed.
+  bool try_reset() noexcept {
+    state oldState = state::consumer_suspended;
+    return m_state.compare_exchange_strong(oldState, state::running, std::memory_order_acquire, std::memory_order_relaxed);
+  }
+
 protected:
   bool completed_with_unhandled_exception() {
     return m_exception != nullptr;
@@ -199,6 +559,7 @@ protected:
 private:
   enum class state { running, consumer_suspended, consumer_detached, finished };
 
+  // Stays atomic in single-threaded builds, because the coroutine can finish on another context.
   std::atomic<state> m_state = state::running;
   detail::continuation m_continuation;
   std::exception_ptr m_exception;
@@ -271,6 +632,46 @@ private:
   T* m_value = nullptr;
 };
 
+// Stores the result inline, so that errors returned with co_return are never thrown or allocated.
+// System errors thrown by the coroutine are stored as the error of the result.
+template <typename T>
+class async_promise<ssh::result<T>> : public async_promise_base {
+public:
+  async_promise() noexcept = default;
+
+  async<ssh::result<T>> get_return_object() noexcept;
+
+  template <typename VALUE, typename = std::enable_if_t<std::is_convertible_v<VALUE&&, ssh::result<T>>>>
+  void return_value(VALUE&& value) noexcept(std::is_nothrow_constructible_v<ssh::result<T>, VALUE&&>) {
+    m_result.emplace(std::forward<VALUE>(value));
+  }
+
+  void unhandled_exception() {
+    try {
+      throw;
+    }
+    catch (const std::system_error& e) {
+      m_result.emplace(e.code());
+    }
+    catch (...) {
+      async_promise_base::unhandled_exception();
+    }
+  }
+
+  ssh::result<T>& result() & {
+    rethrow_if_unhandled_exception();
+    return *m_result;
+  }
+
+  ssh::result<T>&& result() && {
+    rethrow_if_unhandled_exception();
+    return std::move(*m_result);
+  }
+
+private:
+  std::optional<ssh::result<T>> m_result;
+};
+
 }  // namespace detail
 
 template <typename T = void>
@@ -379,11 +780,21 @@ public:
       }
 
       void start(detail::continuation c) noexcept {
-        if (!m_coroutine || m_coroutine.promise().is_ready() || !m_coroutine.promise().try_await(c)) {
+        if (!try_start(c)) {
           c.resume();
         }
       }
 
+      // Registers the continuation. Returns false when the coroutine already completed.
+      bool try_start(detail::continuation c) noexcept {
+        return m_coroutine && !m_coroutine.promise().is_ready() && m_coroutine.promise().try_await(c);
+      }
+
+      // Removes the continuation registered by try_start. Returns false when it is already being resumed.
+      bool try_stop() noexcept {
+        return m_coroutine && m_coroutine.promise().try_reset();
+      }
+
     private:
       coroutine_handle<promise_type> m_coroutine;
     };
@@ -417,191 +828,472 @@ inline async<void> detail::async_promise<void>::get_return_object() noexcept {
   return async<void>{ coroutine_handle<async_promise<void>>::from_promise(*this) };
 }
 
-// == cppcoro/include/cppcoro/async_generator.hpp =====================================================================
-
 template <typename T>
-class async_generator;
+async<ssh::result<T>> detail::async_promise<ssh::result<T>>::get_return_object() noexcept {
+  return async<ssh::result<T>>{ coroutine_handle<async_promise<ssh::result<T>>>::from_promise(*this) };
+}
+
+// == ssh/when_all ====================================================================================================
 
 namespace detail {
 
+struct void_value {};
+
+template <typename Task>
+using task_value_t = typename std::remove_reference_t<Task>::value_type;
+
 template <typename T>
-class async_generator_iterator;
-class async_generator_yield_operation;
-class async_generator_advance_operation;
+using when_all_value_t = std::conditional_t<std::is_void_v<T>, void_value, T>;
+
+// Returns the result of a completed task. Rethrows the exception of the task.
+template <typename Task>
+decltype(auto) when_all_result(Task&& task) {
+  if constexpr (std::is_void_v<task_value_t<Task>>) {
+    std::forward<Task>(task).operator co_await().await_resume();
+    return void_value{};
+  } else {
+    return std::forward<Task>(task).operator co_await().await_resume();
+  }
+}
 
-class async_generator_promise_base {
+// Counts the tasks that did not complete yet and resumes the awaiting coroutine when the last one completes.
+class when_all_counter {
 public:
-  async_generator_promise_base() noexcept = default;
+  explicit when_all_counter(std::size_t count) noexcept : m_count(count + 1) {
+  }
 
-  async_generator_promise_base(const async_generator_promise_base& other) = delete;
-  async_generator_promise_base& operator=(const async_generator_promise_base& other) = delete;
+  when_all_counter(const when_all_counter& other) = delete;
+  when_all_counter& operator=(const when_all_counter& other) = delete;
 
-  constexpr suspend_always initial_suspend() const noexcept {
-    return {};
+  template <typename Task>
+  void start(Task& task) noexcept {
+    task.get_starter().start(continuation{ &when_all_counter::complete, this });
   }
 
-  async_generator_yield_operation final_suspend() noexcept;
+  // Returns false when all started tasks already completed.
+  bool try_await(coroutine_handle<> awaiter) noexcept {
+    m_awaiter = awaiter;
+    return m_count.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
 
-  void unhandled_exception() {
-    if (m_state.load(std::memory_order_relaxed) != state::cancelled) {
-      m_exception = std::current_exception();
+private:
+  static coroutine_handle<> complete(void* state) noexcept {
+    auto& counter = *static_cast<when_all_counter*>(state);
+    if (counter.m_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      return counter.m_awaiter;
     }
+    return noop_coroutine();
   }
 
-  constexpr void return_void() noexcept {
+  // Stays atomic in single-threaded builds, because the tasks can finish on other contexts.
+  std::atomic<std::size_t> m_count;
+  coroutine_handle<> m_awaiter;
+};
+
+template <typename... Tasks>
+class when_all_ready_awaitable {
+public:
+  explicit when_all_ready_awaitable(Tasks&&... tasks) noexcept : m_tasks(std::forward<Tasks>(tasks)...) {
   }
 
-  bool finished() const noexcept {
-    return m_currentValue == nullptr;
+  bool await_ready() const noexcept {
+    return std::apply([](const auto&... tasks) { return (tasks.is_ready() && ...); }, m_tasks);
   }
 
-  void rethrow_if_unhandled_exception() {
-    if (m_exception) {
-      std::rethrow_exception(std::move(m_exception));
-    }
+  bool await_suspend(coroutine_handle<> awaiter) noexcept {
+    std::apply([this](auto&... tasks) { (m_counter.start(tasks), ...); }, m_tasks);
+    return m_counter.try_await(awaiter);
   }
 
-  bool request_cancellation() noexcept {
-    const auto previousState = m_state.exchange(state::cancelled, std::memory_order_acq_rel);
-    assert(previousState != state::value_not_ready_consumer_suspended);
-    assert(previousState != state::cancelled);
-    return previousState == state::value_ready_producer_suspended;
+  constexpr void await_resume() const noexcept {
   }
 
 protected:
-  async_generator_yield_operation internal_yield_value() noexcept;
-
-private:
-  friend class async_generator_yield_operation;
-  friend class async_generator_advance_operation;
-
-  enum class state { value_not_ready_consumer_active, value_not_ready_consumer_suspended, value_ready_producer_active, value_ready_producer_suspended, cancelled };
+  std::tuple<Tasks...> m_tasks;
+  when_all_counter m_counter{ sizeof...(Tasks) };
+};
 
-  std::atomic<state> m_state = state::value_ready_producer_suspended;
-  coroutine_handle<> m_consumerCoroutine;
-  std::exception_ptr m_exception;
+template <typename... Tasks>
+class when_all_awaitable : public when_all_ready_awaitable<Tasks...> {
+public:
+  using when_all_ready_awaitable<Tasks...>::when_all_ready_awaitable;
 
-protected:
-  void* m_currentValue = nullptr;
+  // Returns the results in argument order and rethrows the first exception.
+  std::tuple<when_all_value_t<task_value_t<Tasks>>...> await_resume() {
+    return std::apply(
+      [](auto&&... tasks) {
+        return std::tuple<when_all_value_t<task_value_t<Tasks>>...>{ when_all_result(std::forward<decltype(tasks)>(tasks))... };
+      },
+      std::move(this->m_tasks));
+  }
 };
 
-class async_generator_yield_operation final {
-  using state = async_generator_promise_base::state;
-
+template <typename Range>
+class when_all_ready_range_awaitable {
 public:
-  async_generator_yield_operation(async_generator_promise_base& promise, state initialState) noexcept : m_promise(promise), m_initialState(initialState) {
+  explicit when_all_ready_range_awaitable(Range&& tasks) noexcept : m_tasks(std::forward<Range>(tasks)), m_counter(m_tasks.size()) {
   }
 
   bool await_ready() const noexcept {
-    return m_initialState == state::value_not_ready_consumer_suspended;
+    return std::all_of(m_tasks.begin(), m_tasks.end(), [](const auto& task) { return task.is_ready(); });
   }
 
-  bool await_suspend(coroutine_handle<> producer) noexcept;
+  bool await_suspend(coroutine_handle<> awaiter) noexcept {
+    for (auto& task : m_tasks) {
+      m_counter.start(task);
+    }
+    return m_counter.try_await(awaiter);
+  }
 
-  constexpr void await_resume() noexcept {
+  constexpr void await_resume() const noexcept {
   }
 
-private:
-  async_generator_promise_base& m_promise;
-  state m_initialState;
+protected:
+  Range m_tasks;
+  when_all_counter m_counter;
 };
 
-inline async_generator_yield_operation async_generator_promise_base::final_suspend() noexcept {
-  m_currentValue = nullptr;
-  return internal_yield_value();
-}
+template <typename Range>
+class when_all_range_awaitable : public when_all_ready_range_awaitable<Range> {
+  using task_type = typename std::remove_reference_t<Range>::value_type;
+  using value_type = task_value_t<task_type>;
 
-inline async_generator_yield_operation async_generator_promise_base::internal_yield_value() noexcept {
-  state currentState = m_state.load(std::memory_order_acquire);
-  assert(currentState != state::value_ready_producer_active);
-  assert(currentState != state::value_ready_producer_suspended);
-  if (currentState == state::value_not_ready_consumer_suspended) {
-    m_state.store(state::value_ready_producer_active, std::memory_order_relaxed);
-    m_consumerCoroutine.resume();
-    currentState = m_state.load(std::memory_order_acquire);
-  }
-  return async_generator_yield_operation{ *this, currentState };
-}
+public:
+  using when_all_ready_range_awaitable<Range>::when_all_ready_range_awaitable;
 
-inline bool async_generator_yield_operation::await_suspend(coroutine_handle<> producer) noexcept {
-  state currentState = m_initialState;
-  if (currentState == state::value_not_ready_consumer_active) {
-    bool producerSuspended = m_promise.m_state.compare_exchange_strong(currentState, state::value_ready_producer_suspended, std::memory_order_release, std::memory_order_acquire);
-    if (producerSuspended) {
-      return true;
-    }
-    if (currentState == state::value_not_ready_consumer_suspended) {
-      m_promise.m_state.store(state::value_ready_producer_active, std::memory_order_relaxed);
-      m_promise.m_consumerCoroutine.resume();
-      currentState = m_promise.m_state.load(std::memory_order_acquire);
-      if (currentState == state::value_not_ready_consumer_suspended) {
-        return false;
+  // Returns the results in range order and rethrows the first exception.
+  auto await_resume() {
+    if constexpr (std::is_void_v<value_type>) {
+      for (auto& task : this->m_tasks) {
+        task.operator co_await().await_resume();
       }
+    } else {
+      std::vector<std::remove_reference_t<value_type>> results;
+      results.reserve(this->m_tasks.size());
+      for (auto& task : this->m_tasks) {
+        if constexpr (std::is_lvalue_reference_v<Range>) {
+          results.push_back(task.operator co_await().await_resume());
+        } else {
+          results.push_back(std::move(task).operator co_await().await_resume());
+        }
+      }
+      return results;
     }
   }
-  if (currentState == state::value_ready_producer_active) {
-    const bool suspendedProducer =
-      m_promise.m_state.compare_exchange_strong(currentState, state::value_ready_producer_suspended, std::memory_order_release, std::memory_order_acquire);
-    if (suspendedProducer) {
-      return true;
-    }
-    if (currentState == state::value_not_ready_consumer_suspended) {
-      return false;
-    }
-  }
-  assert(currentState == state::cancelled);
-  producer.destroy();
-  return true;
-}
+};
 
-class async_generator_advance_operation {
-  using state = async_generator_promise_base::state;
+}  // namespace detail
+
+// Resumes the awaiting coroutine when all tasks completed. Tasks passed as rvalues are owned by the awaitable.
+template <typename... Tasks>
+auto when_all_ready(Tasks&&... tasks) noexcept {
+  return detail::when_all_ready_awaitable<Tasks...>{ std::forward<Tasks>(tasks)... };
+}
+
+// Like when_all_ready but resumes with a tuple of the task results. Void results are returned as detail::void_value.
+template <typename... Tasks>
+auto when_all(Tasks&&... tasks) noexcept {
+  return detail::when_all_awaitable<Tasks...>{ std::forward<Tasks>(tasks)... };
+}
+
+template <typename T>
+auto when_all_ready(std::vector<async<T>>& tasks) noexcept {
+  return detail::when_all_ready_range_awaitable<std::vector<async<T>>&>{ tasks };
+}
+
+template <typename T>
+auto when_all_ready(std::vector<async<T>>&& tasks) noexcept {
+  return detail::when_all_ready_range_awaitable<std::vector<async<T>>>{ std::move(tasks) };
+}
+
+// Like when_all_ready but resumes with a vector of the task results or nothing for void tasks.
+template <typename T>
+auto when_all(std::vector<async<T>>& tasks) noexcept {
+  return detail::when_all_range_awaitable<std::vector<async<T>>&>{ tasks };
+}
+
+template <typename T>
+auto when_all(std::vector<async<T>>&& tasks) noexcept {
+  return detail::when_all_range_awaitable<std::vector<async<T>>>{ std::move(tasks) };
+}
+
+// == ssh/when_any ====================================================================================================
+
+namespace detail {
+
+// Registers a continuation on every task until one completes and removes the others again. The state holds
+// a reference for the registration and one for each registered continuation, so that the awaiting coroutine
+// is only resumed when no continuation can access the awaitable anymore.
+template <typename Derived>
+class when_any_counter {
+public:
+  when_any_counter() noexcept = default;
+
+  when_any_counter(const when_any_counter& other) = delete;
+  when_any_counter& operator=(const when_any_counter& other) = delete;
 
 protected:
-  async_generator_advance_operation(std::nullptr_t) noexcept {
+  static constexpr std::size_t completed = std::size_t(1) << (std::numeric_limits<std::size_t>::digits - 1);
+  static constexpr std::size_t registered = completed >> 1;
+  static constexpr std::size_t references = registered - 1;
+
+  // Returns false when registration must stop, because a task completed.
+  template <typename Task>
+  bool start(Task& task) noexcept {
+    if (m_state.load(std::memory_order_acquire) & completed) {
+      return false;
+    }
+    m_state.fetch_add(1, std::memory_order_relaxed);
+    if (task.get_starter().try_start(continuation{ &when_any_counter::complete, this })) {
+      return true;
+    }
+    release(m_state.load(std::memory_order_relaxed));
+    return false;
   }
 
-  async_generator_advance_operation(async_generator_promise_base& promise, coroutine_handle<> producerCoroutine) noexcept :
-    m_promise(std::addressof(promise)), m_producerCoroutine(producerCoroutine) {
-    state initialState = promise.m_state.load(std::memory_order_acquire);
-    if (initialState == state::value_ready_producer_suspended) {
-      promise.m_state.store(state::value_not_ready_consumer_active, std::memory_order_relaxed);
-      producerCoroutine.resume();
-      initialState = promise.m_state.load(std::memory_order_acquire);
+  bool suspend(coroutine_handle<> awaiter) noexcept {
+    m_awaiter = awaiter;
+    static_cast<Derived&>(*this).start_all();
+    if (m_state.fetch_or(registered, std::memory_order_acq_rel) & completed) {
+      return stop();
     }
-    m_initialState = initialState;
+    return true;
   }
 
+private:
+  static coroutine_handle<> complete(void* state) noexcept {
+    auto& counter = *static_cast<when_any_counter*>(state);
+    const auto oldState = counter.release(counter.m_state.load(std::memory_order_relaxed));
+    if ((oldState & registered) && !(oldState & completed)) {
+      if (!counter.stop()) {
+        return counter.m_awaiter;
+      }
+    } else if (((oldState - 1) & references) == 0) {
+      return counter.m_awaiter;
+    }
+    return noop_coroutine();
+  }
+
+  // Releases the reference of a completed task and marks the state as completed.
+  std::size_t release(std::size_t state) noexcept {
+    while (!m_state.compare_exchange_weak(state, (state - 1) | completed, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+    }
+    return state;
+  }
+
+  // Removes the remaining continuations and releases the registration reference.
+  // Returns true when a continuation is still running and resumes the awaiting coroutine.
+  bool stop() noexcept {
+    const auto count = static_cast<Derived&>(*this).stop_all() + 1;
+    return ((m_state.fetch_sub(count, std::memory_order_acq_rel) - count) & references) != 0;
+  }
+
+  std::atomic<std::size_t> m_state = 1;
+  coroutine_handle<> m_awaiter;
+};
+
+template <typename... Tasks>
+class when_any_awaitable : public when_any_counter<when_any_awaitable<Tasks...>> {
 public:
+  explicit when_any_awaitable(Tasks&... tasks) noexcept : m_tasks(tasks...) {
+  }
+
   bool await_ready() const noexcept {
-    return m_initialState == state::value_ready_producer_suspended;
+    return std::apply([](const auto&... tasks) { return (tasks.is_ready() || ...); }, m_tasks);
   }
 
-  bool await_suspend(coroutine_handle<> consumerCoroutine) noexcept {
-    m_promise->m_consumerCoroutine = consumerCoroutine;
-    auto currentState = m_initialState;
-    if (currentState == state::value_ready_producer_active) {
-      if (m_promise->m_state.compare_exchange_strong(currentState, state::value_not_ready_consumer_suspended, std::memory_order_release, std::memory_order_acquire)) {
-        return true;
-      }
-      assert(currentState == state::value_ready_producer_suspended);
-      m_promise->m_state.store(state::value_not_ready_consumer_active, std::memory_order_relaxed);
-      m_producerCoroutine.resume();
-      currentState = m_promise->m_state.load(std::memory_order_acquire);
-      if (currentState == state::value_ready_producer_suspended) {
-        return false;
+  bool await_suspend(coroutine_handle<> awaiter) noexcept {
+    return this->suspend(awaiter);
+  }
+
+  // Returns the index of the first completed task.
+  std::size_t await_resume() const noexcept {
+    std::size_t index = 0;
+    std::apply([&index](const auto&... tasks) { ((!tasks.is_ready() && ++index) && ...); }, m_tasks);
+    return index;
+  }
+
+private:
+  friend class when_any_counter<when_any_awaitable>;
+
+  void start_all() noexcept {
+    std::apply([this](auto&... tasks) { (this->start(tasks) && ...); }, m_tasks);
+  }
+
+  std::size_t stop_all() noexcept {
+    return std::apply([](auto&... tasks) { return (std::size_t(tasks.get_starter().try_stop()) + ... + 0); }, m_tasks);
+  }
+
+  std::tuple<Tasks&...> m_tasks;
+};
+
+template <typename T>
+class when_any_range_awaitable : public when_any_counter<when_any_range_awaitable<T>> {
+public:
+  explicit when_any_range_awaitable(std::vector<async<T>>& tasks) noexcept : m_tasks(tasks) {
+    assert(!tasks.empty());
+  }
+
+  bool await_ready() const noexcept {
+    return std::any_of(m_tasks.begin(), m_tasks.end(), [](const auto& task) { return task.is_ready(); });
+  }
+
+  bool await_suspend(coroutine_handle<> awaiter) noexcept {
+    return this->suspend(awaiter);
+  }
+
+  // Returns the index of the first completed task.
+  std::size_t await_resume() const noexcept {
+    const auto it = std::find_if(m_tasks.begin(), m_tasks.end(), [](const auto& task) { return task.is_ready(); });
+    return static_cast<std::size_t>(it - m_tasks.begin());
+  }
+
+private:
+  friend class when_any_counter<when_any_range_awaitable>;
+
+  void start_all() noexcept {
+    for (auto& task : m_tasks) {
+      if (!this->start(task)) {
+        break;
       }
     }
-    assert(currentState == state::value_not_ready_consumer_active);
-    return m_promise->m_state.compare_exchange_strong(currentState, state::value_not_ready_consumer_suspended, std::memory_order_release, std::memory_order_acquire);
+  }
+
+  std::size_t stop_all() noexcept {
+    std::size_t count = 0;
+    for (auto& task : m_tasks) {
+      count += task.get_starter().try_stop() ? 1 : 0;
+    }
+    return count;
+  }
+
+  std::vector<async<T>>& m_tasks;
+};
+
+}  // namespace detail
+
+// Resumes the awaiting coroutine with the index of a completed task. The other tasks keep running and must
+// be awaited or detached by the caller.
+template <typename... T>
+auto when_any(async<T>&... tasks) noexcept {
+  static_assert(sizeof...(T) > 0);
+  return detail::when_any_awaitable<async<T>...>{ tasks... };
+}
+
+template <typename T>
+auto when_any(std::vector<async<T>>& tasks) noexcept {
+  return detail::when_any_range_awaitable<T>{ tasks };
+}
+
+// == cppcoro/include/cppcoro/async_generator.hpp =====================================================================
+
+template <typename T>
+class async_generator;
+
+namespace detail {
+
+template <typename T>
+class async_generator_iterator;
+class async_generator_yield_operation;
+class async_generator_advance_operation;
+
+class async_generator_promise_base : public frame {
+public:
+  async_generator_promise_base() noexcept = default;
+
+  async_generator_promise_base(const async_generator_promise_base& other) = delete;
+  async_generator_promise_base& operator=(const async_generator_promise_base& other) = delete;
+
+  constexpr suspend_always initial_suspend() const noexcept {
+    return {};
+  }
+
+  async_generator_yield_operation final_suspend() noexcept;
+
+  void unhandled_exception() noexcept {
+    m_exception = std::current_exception();
+  }
+
+  constexpr void return_void() noexcept {
+  }
+
+  bool finished() const noexcept {
+    return m_currentValue == nullptr;
+  }
+
+  void rethrow_if_unhandled_exception() {
+    if (m_exception) {
+      std::rethrow_exception(std::move(m_exception));
+    }
   }
 
 protected:
-  async_generator_promise_base* m_promise = nullptr;
-  coroutine_handle<> m_producerCoroutine;
+  async_generator_yield_operation internal_yield_value() noexcept;
+
+private:
+  friend class async_generator_yield_operation;
+  friend class async_generator_advance_operation;
+
+  coroutine_handle<> m_consumerCoroutine;
+  std::exception_ptr m_exception;
+
+protected:
+  void* m_currentValue = nullptr;
+};
+
+// The producer only runs while the consumer is suspended in an advance operation. Both sides transfer
+// control to each other from await_suspend, so that nested generators run in constant stack space.
+class async_generator_yield_operation final {
+public:
+  explicit async_generator_yield_operation(coroutine_handle<> consumer) noexcept : m_consumer(consumer) {
+  }
+
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  coroutine_handle<> await_suspend(coroutine_handle<>) noexcept {
+    return m_consumer;
+  }
+
+  constexpr void await_resume() noexcept {
+  }
 
 private:
-  state m_initialState;
+  coroutine_handle<> m_consumer;
+};
+
+inline async_generator_yield_operation async_generator_promise_base::final_suspend() noexcept {
+  m_currentValue = nullptr;
+  return internal_yield_value();
+}
+
+inline async_generator_yield_operation async_generator_promise_base::internal_yield_value() noexcept {
+  return async_generator_yield_operation{ m_consumerCoroutine };
+}
+
+class async_generator_advance_operation {
+protected:
+  async_generator_advance_operation(std::nullptr_t) noexcept {
+  }
+
+  async_generator_advance_operation(async_generator_promise_base& promise, coroutine_handle<> producerCoroutine) noexcept :
+    m_promise(std::addressof(promise)), m_producerCoroutine(producerCoroutine) {
+  }
+
+public:
+  constexpr bool await_ready() const noexcept {
+    return false;
+  }
+
+  coroutine_handle<> await_suspend(coroutine_handle<> consumerCoroutine) noexcept {
+    m_promise->m_consumerCoroutine = consumerCoroutine;
+    return m_producerCoroutine;
+  }
+
+protected:
+  async_generator_promise_base* m_promise = nullptr;
+  coroutine_handle<> m_producerCoroutine;
 };
 
 template <typename T>
@@ -719,7 +1411,7 @@ public:
   }
 
   bool await_ready() const noexcept {
-    return m_promise == nullptr || async_generator_advance_operation::await_ready();
+    return m_promise == nullptr;
   }
 
   async_generator_iterator<T> await_resume() {
@@ -751,9 +1443,7 @@ public:
 
   ~async_generator() {
     if (m_coroutine) {
-      if (m_coroutine.promise().request_cancellation()) {
-        m_coroutine.destroy();
-      }
+      m_coroutine.destroy();
     }
   }
 
@@ -800,6 +1490,54 @@ async_generator<T> async_generator_promise<T>::get_return_object() noexcept {
 
 }  // namespace detail
 
+// == ssh/detail/waiter ===============================================================================================
+
+namespace detail {
+
+// Intrusive queue entry of a coroutine that waits for a synchronization primitive.
+class waiter {
+public:
+  waiter() noexcept = default;
+
+  waiter(const waiter& other) = delete;
+  waiter& operator=(const waiter& other) = delete;
+
+  // Resumes the awaiting coroutine on the calling thread. Waiters that are released while another waiter is
+  // resumed on the same thread are queued and resumed by the outermost call, so that chains of releases
+  // do not nest stack frames.
+  void resume() noexcept {
+    struct queue {
+      waiter* head = nullptr;
+      waiter** tail = &head;
+      bool active = false;
+    };
+    thread_local queue pending;
+    m_resumeNext = nullptr;
+    *pending.tail = this;
+    pending.tail = &m_resumeNext;
+    if (pending.active) {
+      return;
+    }
+    pending.active = true;
+    while (const auto next = pending.head) {
+      pending.head = next->m_resumeNext;
+      if (!pending.head) {
+        pending.tail = &pending.head;
+      }
+      next->m_awaiter.resume();
+    }
+    pending.active = false;
+  }
+
+protected:
+  coroutine_handle<> m_awaiter;
+
+private:
+  waiter* m_resumeNext = nullptr;
+};
+
+}  // namespace detail
+
 // == cppcoro/include/cppcoro/async_mutex.hpp =========================================================================
 
 class async_mutex_lock;
@@ -825,7 +1563,7 @@ private:
   static constexpr std::uintptr_t not_locked = 1;
   static constexpr std::uintptr_t locked_no_waiters = 0;
 
-  std::atomic<std::uintptr_t> m_state = not_locked;
+  detail::atomic<std::uintptr_t> m_state = not_locked;
   async_mutex_lock_operation* m_waiters = nullptr;
 };
 
@@ -850,7 +1588,7 @@ private:
   async_mutex* m_mutex = nullptr;
 };
 
-class async_mutex_lock_operation {
+class async_mutex_lock_operation : public detail::waiter {
 public:
   explicit async_mutex_lock_operation(async_mutex& mutex) noexcept : m_mutex(mutex) {
   }
@@ -871,7 +1609,6 @@ protected:
 
 private:
   async_mutex_lock_operation* m_next = nullptr;
-  coroutine_handle<> m_awaiter;
 };
 
 class async_mutex_scoped_lock_operation : public async_mutex_lock_operation {
@@ -925,7 +1662,7 @@ inline void async_mutex::unlock() {
   }
   assert(waitersHead != nullptr);
   m_waiters = waitersHead->m_next;
-  waitersHead->m_awaiter.resume();
+  waitersHead->resume();
 }
 
 inline bool async_mutex_lock_operation::await_suspend(coroutine_handle<> awaiter) noexcept {
@@ -945,6 +1682,615 @@ inline bool async_mutex_lock_operation::await_suspend(coroutine_handle<> awaiter
   }
 }
 
+// == cppcoro/include/cppcoro/async_manual_reset_event.hpp ============================================================
+
+class async_manual_reset_event_operation;
+
+class async_manual_reset_event {
+public:
+  explicit async_manual_reset_event(bool initiallySet = false) noexcept : m_state(initiallySet ? static_cast<void*>(this) : nullptr) {
+  }
+
+  async_manual_reset_event(const async_manual_reset_event& other) = delete;
+  async_manual_reset_event& operator=(const async_manual_reset_event& other) = delete;
+
+  ~async_manual_reset_event() {
+    assert(m_state.load(std::memory_order_relaxed) == nullptr || m_state.load(std::memory_order_relaxed) == static_cast<void*>(this));
+  }
+
+  async_manual_reset_event_operation operator co_await() const noexcept;
+
+  bool is_set() const noexcept {
+    return m_state.load(std::memory_order_acquire) == static_cast<const void*>(this);
+  }
+
+  // Sets the event and resumes all waiting coroutines on the calling thread.
+  void set() noexcept;
+
+  // Resets the event. Does nothing when the event is not set.
+  void reset() noexcept {
+    void* oldState = this;
+    m_state.compare_exchange_strong(oldState, nullptr, std::memory_order_relaxed);
+  }
+
+private:
+  friend class async_manual_reset_event_operation;
+
+  // The address of the event when set, nullptr when not set and without waiters or the list of waiters.
+  mutable detail::atomic<void*> m_state;
+};
+
+class async_manual_reset_event_operation : public detail::waiter {
+public:
+  explicit async_manual_reset_event_operation(const async_manual_reset_event& event) noexcept : m_event(event) {
+  }
+
+  bool await_ready() const noexcept {
+    return m_event.is_set();
+  }
+
+  bool await_suspend(coroutine_handle<> awaiter) noexcept {
+    m_awaiter = awaiter;
+    const void* const setState = static_cast<const void*>(&m_event);
+    void* oldState = m_event.m_state.load(std::memory_order_acquire);
+    do {
+      if (oldState == setState) {
+        return false;
+      }
+      m_next = static_cast<async_manual_reset_event_operation*>(oldState);
+    } while (!m_event.m_state.compare_exchange_weak(oldState, static_cast<void*>(this), std::memory_order_release, std::memory_order_acquire));
+    return true;
+  }
+
+  constexpr void await_resume() const noexcept {
+  }
+
+private:
+  friend class async_manual_reset_event;
+
+  const async_manual_reset_event& m_event;
+  async_manual_reset_event_operation* m_next = nullptr;
+};
+
+inline async_manual_reset_event_operation async_manual_reset_event::operator co_await() const noexcept {
+  return async_manual_reset_event_operation{ *this };
+}
+
+inline void async_manual_reset_event::set() noexcept {
+  void* const setState = static_cast<void*>(this);
+  void* oldState = m_state.exchange(setState, std::memory_order_acq_rel);
+  if (oldState != setState) {
+    auto* current = static_cast<async_manual_reset_event_operation*>(oldState);
+    while (current != nullptr) {
+      auto* next = current->m_next;
+      current->resume();
+      current = next;
+    }
+  }
+}
+
+// == cppcoro/include/cppcoro/async_latch.hpp =========================================================================
+
+class async_latch {
+public:
+  // Constructs a latch that is ready when the count is zero or less.
+  explicit async_latch(std::ptrdiff_t initialCount) noexcept : m_count(initialCount), m_event(initialCount <= 0) {
+  }
+
+  async_latch(const async_latch& other) = delete;
+  async_latch& operator=(const async_latch& other) = delete;
+
+  bool is_ready() const noexcept {
+    return m_event.is_set();
+  }
+
+  // Decrements the count and resumes all waiting coroutines on the calling thread when it reaches zero.
+  void count_down(std::ptrdiff_t n = 1) noexcept {
+    if (m_count.fetch_sub(n, std::memory_order_acq_rel) <= n) {
+      m_event.set();
+    }
+  }
+
+  auto operator co_await() const noexcept {
+    return m_event.operator co_await();
+  }
+
+private:
+  detail::atomic<std::ptrdiff_t> m_count;
+  async_manual_reset_event m_event;
+};
+
+// == ssh/detail/async_permits ========================================================================================
+
+namespace detail {
+
+class async_permits_operation;
+
+// Counts available permits and waiting coroutines in a single word. Waiters are pushed to a lock-free stack
+// and moved to a FIFO list by the one thread that raises the number of resumable waiters from zero.
+// Based on the cppcoro async_auto_reset_event.
+class async_permits {
+public:
+  explicit async_permits(std::uint32_t count) noexcept : m_state(count) {
+  }
+
+  async_permits(const async_permits& other) = delete;
+  async_permits& operator=(const async_permits& other) = delete;
+
+  ~async_permits() {
+    assert(m_newWaiters.load(std::memory_order_relaxed) == nullptr);
+    assert(m_waiters == nullptr);
+  }
+
+  bool try_acquire() noexcept {
+    auto oldState = m_state.load(std::memory_order_relaxed);
+    while (permits(oldState) > waiters(oldState)) {
+      if (m_state.compare_exchange_weak(oldState, oldState - permit_increment, std::memory_order_acquire, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Adds up to count permits, but never more than limit available permits.
+  void release(std::uint32_t count, std::uint32_t limit) noexcept {
+    auto oldState = m_state.load(std::memory_order_relaxed);
+    std::uint64_t newState = 0;
+    do {
+      const auto available = permits(oldState) > waiters(oldState) ? permits(oldState) - waiters(oldState) : 0;
+      if (available >= limit) {
+        return;
+      }
+      newState = oldState + std::min(count, limit - available) * permit_increment;
+    } while (!m_state.compare_exchange_weak(oldState, newState, std::memory_order_acq_rel, std::memory_order_relaxed));
+    if (permits(oldState) == 0 && waiters(oldState) != 0) {
+      resume_waiters(newState);
+    }
+  }
+
+  // Removes one available permit.
+  void reset() noexcept {
+    auto oldState = m_state.load(std::memory_order_relaxed);
+    while (permits(oldState) > waiters(oldState)) {
+      if (m_state.compare_exchange_weak(oldState, oldState - permit_increment, std::memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+
+  std::uint32_t available() const noexcept {
+    const auto state = m_state.load(std::memory_order_relaxed);
+    return permits(state) > waiters(state) ? permits(state) - waiters(state) : 0;
+  }
+
+private:
+  friend class async_permits_operation;
+
+  static constexpr std::uint64_t permit_increment = 1;
+  static constexpr std::uint64_t waiter_increment = std::uint64_t(1) << 32;
+
+  static constexpr std::uint32_t permits(std::uint64_t state) noexcept {
+    return static_cast<std::uint32_t>(state);
+  }
+
+  static constexpr std::uint32_t waiters(std::uint64_t state) noexcept {
+    return static_cast<std::uint32_t>(state >> 32);
+  }
+
+  static constexpr std::uint32_t resumable(std::uint64_t state) noexcept {
+    return std::min(permits(state), waiters(state));
+  }
+
+  void resume_waiters(std::uint64_t initialState) noexcept;
+
+  detail::atomic<std::uint64_t> m_state;
+  detail::atomic<async_permits_operation*> m_newWaiters = nullptr;
+  async_permits_operation* m_waiters = nullptr;
+};
+
+class async_permits_operation : public waiter {
+public:
+  explicit async_permits_operation(async_permits& permits) noexcept : m_permits(permits) {
+  }
+
+  // Acquires a permit without suspending when one is available. An operation that is never awaited takes no permit.
+  bool await_ready() noexcept {
+    return m_permits.try_acquire();
+  }
+
+  bool await_suspend(coroutine_handle<> awaiter) noexcept {
+    m_awaiter = awaiter;
+    auto* head = m_permits.m_newWaiters.load(std::memory_order_relaxed);
+    do {
+      m_next = head;
+    } while (!m_permits.m_newWaiters.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+    const auto oldState = m_permits.m_state.fetch_add(async_permits::waiter_increment, std::memory_order_acq_rel);
+    if (async_permits::permits(oldState) != 0 && async_permits::waiters(oldState) == 0) {
+      m_permits.resume_waiters(oldState + async_permits::waiter_increment);
+    }
+    // The waiter is resumed by the second of this call and resume_waiters to release its reference.
+    return m_refCount.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+
+  constexpr void await_resume() const noexcept {
+  }
+
+private:
+  friend class async_permits;
+
+  async_permits& m_permits;
+  async_permits_operation* m_next = nullptr;
+  detail::atomic<std::uint32_t> m_refCount = 2;
+};
+
+inline void async_permits::resume_waiters(std::uint64_t initialState) noexcept {
+  async_permits_operation* waitersToResume = nullptr;
+  async_permits_operation** waitersToResumeEnd = &waitersToResume;
+  auto count = resumable(initialState);
+  assert(count > 0);
+  do {
+    for (std::uint32_t i = 0; i < count; i++) {
+      if (m_waiters == nullptr) {
+        auto* newWaiters = m_newWaiters.exchange(nullptr, std::memory_order_acquire);
+        assert(newWaiters != nullptr);
+        do {
+          auto* next = newWaiters->m_next;
+          newWaiters->m_next = m_waiters;
+          m_waiters = newWaiters;
+          newWaiters = next;
+        } while (newWaiters != nullptr);
+      }
+      auto* waiter = m_waiters;
+      m_waiters = waiter->m_next;
+      waiter->m_next = nullptr;
+      *waitersToResumeEnd = waiter;
+      waitersToResumeEnd = &waiter->m_next;
+    }
+    const auto delta = std::uint64_t(count) * permit_increment + std::uint64_t(count) * waiter_increment;
+    const auto newState = m_state.fetch_sub(delta, std::memory_order_acq_rel) - delta;
+    count = resumable(newState);
+  } while (count > 0);
+  while (waitersToResume != nullptr) {
+    auto* const waiter = waitersToResume;
+    waitersToResume = waiter->m_next;
+    if (waiter->m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      waiter->resume();
+    }
+  }
+}
+
+}  // namespace detail
+
+// == cppcoro/include/cppcoro/async_auto_reset_event.hpp ==============================================================
+
+class async_auto_reset_event {
+public:
+  explicit async_auto_reset_event(bool initiallySet = false) noexcept : m_permits(initiallySet ? 1 : 0) {
+  }
+
+  // Resumes one waiting coroutine and resets the event.
+  detail::async_permits_operation operator co_await() noexcept {
+    return detail::async_permits_operation{ m_permits };
+  }
+
+  // Sets the event or resumes one waiting coroutine on the calling thread. Does nothing when the event is set.
+  void set() noexcept {
+    m_permits.release(1, 1);
+  }
+
+  // Resets the event. Does nothing when the event is not set.
+  void reset() noexcept {
+    m_permits.reset();
+  }
+
+private:
+  detail::async_permits m_permits;
+};
+
+// == ssh/async_semaphore =============================================================================================
+
+class async_semaphore_lock;
+class async_semaphore_scoped_acquire_operation;
+
+class async_semaphore {
+public:
+  explicit async_semaphore(std::uint32_t count) noexcept : m_permits(count) {
+  }
+
+  bool try_acquire() noexcept {
+    return m_permits.try_acquire();
+  }
+
+  // Resumes the awaiting coroutine when a permit is available.
+  detail::async_permits_operation acquire_async() noexcept {
+    return detail::async_permits_operation{ m_permits };
+  }
+
+  // Like acquire_async but resumes with a lock that releases the permit.
+  async_semaphore_scoped_acquire_operation scoped_acquire_async() noexcept;
+
+  // Returns permits and resumes waiting coroutines on the calling thread.
+  void release(std::uint32_t count = 1) noexcept {
+    m_permits.release(count, std::numeric_limits<std::uint32_t>::max());
+  }
+
+  std::uint32_t available() const noexcept {
+    return m_permits.available();
+  }
+
+private:
+  friend class async_semaphore_scoped_acquire_operation;
+
+  detail::async_permits m_permits;
+};
+
+class async_semaphore_lock {
+public:
+  explicit async_semaphore_lock(async_semaphore& semaphore, std::adopt_lock_t) noexcept : m_semaphore(&semaphore) {
+  }
+
+  async_semaphore_lock(async_semaphore_lock&& other) noexcept : m_semaphore(std::exchange(other.m_semaphore, nullptr)) {
+  }
+
+  async_semaphore_lock(const async_semaphore_lock& other) = delete;
+  async_semaphore_lock& operator=(const async_semaphore_lock& other) = delete;
+
+  ~async_semaphore_lock() {
+    if (m_semaphore != nullptr) {
+      m_semaphore->release();
+    }
+  }
+
+private:
+  async_semaphore* m_semaphore = nullptr;
+};
+
+class async_semaphore_scoped_acquire_operation : public detail::async_permits_operation {
+public:
+  explicit async_semaphore_scoped_acquire_operation(async_semaphore& semaphore) noexcept :
+    detail::async_permits_operation(semaphore.m_permits), m_semaphore(semaphore) {
+  }
+
+  [[nodiscard]] async_semaphore_lock await_resume() const noexcept {
+    return async_semaphore_lock{ m_semaphore, std::adopt_lock };
+  }
+
+private:
+  async_semaphore& m_semaphore;
+};
+
+inline async_semaphore_scoped_acquire_operation async_semaphore::scoped_acquire_async() noexcept {
+  return async_semaphore_scoped_acquire_operation{ *this };
+}
+
+// == ssh/async_shared_mutex ==========================================================================================
+
+class async_shared_mutex_lock;
+class async_shared_mutex_lock_operation;
+class async_shared_mutex_scoped_lock_operation;
+
+// Lock that is held by one writer or by a group of readers. Waiters are handed the lock in FIFO order and
+// consecutive readers at the front of the queue are resumed together. Readers only join a group that
+// holds the lock while no other coroutine is queued.
+class async_shared_mutex {
+public:
+  async_shared_mutex() noexcept = default;
+
+  ~async_shared_mutex();
+
+  bool try_lock() noexcept;
+  bool try_lock_shared() noexcept;
+
+  async_shared_mutex_lock_operation lock_async() noexcept;
+  async_shared_mutex_lock_operation lock_shared_async() noexcept;
+  async_shared_mutex_scoped_lock_operation scoped_lock_async() noexcept;
+  async_shared_mutex_scoped_lock_operation scoped_lock_shared_async() noexcept;
+
+  void unlock();
+  void unlock_shared();
+
+private:
+  friend class async_shared_mutex_lock_operation;
+
+  static constexpr std::uintptr_t not_locked = 1;
+  static constexpr std::uintptr_t locked_no_waiters = 0;
+
+  // Set in the reader count when writers are queued behind the readers that hold the lock.
+  static constexpr std::uint32_t closed = std::uint32_t(1) << 31;
+
+  bool try_join() noexcept;
+  void release() noexcept;
+
+  detail::atomic<std::uintptr_t> m_state = not_locked;
+  detail::atomic<std::uint32_t> m_readers = 0;
+  async_shared_mutex_lock_operation* m_waiters = nullptr;
+};
+
+class async_shared_mutex_lock {
+public:
+  explicit async_shared_mutex_lock(async_shared_mutex& mutex, bool shared, std::adopt_lock_t) noexcept : m_mutex(&mutex), m_shared(shared) {
+  }
+
+  async_shared_mutex_lock(async_shared_mutex_lock&& other) noexcept : m_mutex(std::exchange(other.m_mutex, nullptr)), m_shared(other.m_shared) {
+  }
+
+  async_shared_mutex_lock(const async_shared_mutex_lock& other) = delete;
+  async_shared_mutex_lock& operator=(const async_shared_mutex_lock& other) = delete;
+
+  ~async_shared_mutex_lock() {
+    if (m_mutex != nullptr) {
+      if (m_shared) {
+        m_mutex->unlock_shared();
+      } else {
+        m_mutex->unlock();
+      }
+    }
+  }
+
+private:
+  async_shared_mutex* m_mutex = nullptr;
+  bool m_shared = false;
+};
+
+class async_shared_mutex_lock_operation : public detail::waiter {
+public:
+  explicit async_shared_mutex_lock_operation(async_shared_mutex& mutex, bool shared) noexcept : m_mutex(mutex), m_shared(shared) {
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  bool await_suspend(coroutine_handle<> awaiter) noexcept;
+
+  void await_resume() const noexcept {
+  }
+
+protected:
+  friend class async_shared_mutex;
+
+  async_shared_mutex& m_mutex;
+  bool m_shared = false;
+
+private:
+  async_shared_mutex_lock_operation* m_next = nullptr;
+};
+
+class async_shared_mutex_scoped_lock_operation : public async_shared_mutex_lock_operation {
+public:
+  using async_shared_mutex_lock_operation::async_shared_mutex_lock_operation;
+
+  [[nodiscard]] async_shared_mutex_lock await_resume() const noexcept {
+    return async_shared_mutex_lock{ m_mutex, m_shared, std::adopt_lock };
+  }
+};
+
+inline async_shared_mutex::~async_shared_mutex() {
+  [[maybe_unused]] auto state = m_state.load(std::memory_order_relaxed);
+  assert(state == not_locked || state == locked_no_waiters);
+  assert(m_waiters == nullptr);
+}
+
+inline bool async_shared_mutex::try_lock() noexcept {
+  auto oldState = not_locked;
+  return m_state.compare_exchange_strong(oldState, locked_no_waiters, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+inline bool async_shared_mutex::try_lock_shared() noexcept {
+  if (try_join()) {
+    return true;
+  }
+  auto oldState = not_locked;
+  if (m_state.compare_exchange_strong(oldState, locked_no_waiters, std::memory_order_acquire, std::memory_order_relaxed)) {
+    m_readers.store(1, std::memory_order_release);
+    return true;
+  }
+  return false;
+}
+
+inline async_shared_mutex_lock_operation async_shared_mutex::lock_async() noexcept {
+  return async_shared_mutex_lock_operation{ *this, false };
+}
+
+inline async_shared_mutex_lock_operation async_shared_mutex::lock_shared_async() noexcept {
+  return async_shared_mutex_lock_operation{ *this, true };
+}
+
+inline async_shared_mutex_scoped_lock_operation async_shared_mutex::scoped_lock_async() noexcept {
+  return async_shared_mutex_scoped_lock_operation{ *this, false };
+}
+
+inline async_shared_mutex_scoped_lock_operation async_shared_mutex::scoped_lock_shared_async() noexcept {
+  return async_shared_mutex_scoped_lock_operation{ *this, true };
+}
+
+inline void async_shared_mutex::unlock() {
+  assert(m_state.load(std::memory_order_relaxed) != not_locked);
+  assert(m_readers.load(std::memory_order_relaxed) == 0);
+  release();
+}
+
+inline void async_shared_mutex::unlock_shared() {
+  const auto readers = m_readers.fetch_sub(1, std::memory_order_acq_rel);
+  assert((readers & ~closed) != 0);
+  if ((readers & ~closed) == 1) {
+    m_readers.store(0, std::memory_order_relaxed);
+    release();
+  }
+}
+
+inline bool async_shared_mutex::try_join() noexcept {
+  auto readers = m_readers.load(std::memory_order_relaxed);
+  while (readers != 0 && (readers & closed) == 0 && m_state.load(std::memory_order_acquire) == locked_no_waiters) {
+    if (m_readers.compare_exchange_weak(readers, readers + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline void async_shared_mutex::release() noexcept {
+  async_shared_mutex_lock_operation* waitersHead = m_waiters;
+  if (waitersHead == nullptr) {
+    auto oldState = locked_no_waiters;
+    const bool releasedLock = m_state.compare_exchange_strong(oldState, not_locked, std::memory_order_release, std::memory_order_relaxed);
+    if (releasedLock) {
+      return;
+    }
+    oldState = m_state.exchange(locked_no_waiters, std::memory_order_acquire);
+    assert(oldState != locked_no_waiters && oldState != not_locked);
+    auto* next = reinterpret_cast<async_shared_mutex_lock_operation*>(oldState);
+    do {
+      auto* temp = next->m_next;
+      next->m_next = waitersHead;
+      waitersHead = next;
+      next = temp;
+    } while (next != nullptr);
+  }
+  assert(waitersHead != nullptr);
+  if (!waitersHead->m_shared) {
+    m_waiters = waitersHead->m_next;
+    waitersHead->resume();
+    return;
+  }
+  auto* last = waitersHead;
+  std::uint32_t readers = 1;
+  while (last->m_next != nullptr && last->m_next->m_shared) {
+    last = last->m_next;
+    readers++;
+  }
+  m_waiters = std::exchange(last->m_next, nullptr);
+  m_readers.store(m_waiters ? readers | closed : readers, std::memory_order_release);
+  while (waitersHead != nullptr) {
+    auto* next = waitersHead->m_next;
+    waitersHead->resume();
+    waitersHead = next;
+  }
+}
+
+inline bool async_shared_mutex_lock_operation::await_suspend(coroutine_handle<> awaiter) noexcept {
+  m_awaiter = awaiter;
+  std::uintptr_t oldState = m_mutex.m_state.load(std::memory_order_acquire);
+  while (true) {
+    if (oldState == async_shared_mutex::not_locked) {
+      if (m_mutex.m_state.compare_exchange_weak(oldState, async_shared_mutex::locked_no_waiters, std::memory_order_acquire, std::memory_order_relaxed)) {
+        if (m_shared) {
+          m_mutex.m_readers.store(1, std::memory_order_release);
+        }
+        return false;
+      }
+    } else {
+      if (m_shared && oldState == async_shared_mutex::locked_no_waiters && m_mutex.try_join()) {
+        return false;
+      }
+      m_next = reinterpret_cast<async_shared_mutex_lock_operation*>(oldState);
+      if (m_mutex.m_state.compare_exchange_weak(oldState, reinterpret_cast<std::uintptr_t>(this), std::memory_order_release, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+}
+
 // == cppcoro/include/cppcoro/generator.hpp ===========================================================================
 
 template <typename T>
@@ -953,7 +2299,7 @@ class generator;
 namespace detail {
 
 template <typename T>
-class generator_promise {
+class generator_promise : public frame {
 public:
   using value_type = std::remove_reference_t<T>;
   using reference_type = std::conditional_t<std::is_reference_v<T>, T, T&>;
@@ -0,0 +1,169 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace ssh {
+
+class cancellation_registration;
+
+namespace detail {
+
+// Registrations are stored in segments of atomic slots, so that adding and removing one does not lock.
+// Removed slots are reused through a lock-free free list. Segments double in size and are only freed with the state.
+class cancellation_state {
+public:
+  cancellation_state() noexcept = default;
+
+  cancellation_state(cancellation_state&& other) = delete;
+  cancellation_state& operator=(cancellation_state&& other) = delete;
+
+  cancellation_state(const cancellation_state& other) = delete;
+  cancellation_state& operator=(const cancellation_state& other) = delete;
+
+  ~cancellation_state();
+
+  bool requested() const noexcept {
+    return requested_.load(std::memory_order_acquire);
+  }
+
+  // Calls the callbacks of all registrations on the calling thread.
+  bool request() noexcept;
+
+  // Returns false when cancellation was already requested. Only allocates when all slots are in use.
+  bool add(cancellation_registration& registration);
+
+  // Waits for the callback when it is running on another thread.
+  void remove(cancellation_registration& registration) noexcept;
+
+private:
+  struct slot {
+    std::atomic<cancellation_registration*> registration = nullptr;
+    std::atomic<std::uint32_t> next = 0;
+  };
+
+  constexpr static std::size_t base = 16;
+  constexpr static std::size_t segments = 24;
+
+  // Returns the slot at the index. The segment must have been allocated.
+  slot& at(std::uint32_t index) noexcept;
+
+  // Returns an unused slot index. Allocates a segment when the index is the first one in it.
+  std::uint32_t acquire();
+
+  // Pushes the slot index onto the free list.
+  void release(std::uint32_t index) noexcept;
+
+  std::atomic_bool requested_ = false;
+  std::atomic<cancellation_registration*> running_ = nullptr;
+  std::atomic<std::thread::id> thread_{};
+
+  // Free list head. The lower half is the slot index plus one, the upper half a tag against ABA.
+  std::atomic<std::uint64_t> free_ = 0;
+  std::atomic<std::uint32_t> size_ = 0;
+
+  // Segment k holds base << k slots. The first one is stored inline.
+  slot head_[base];
+  std::atomic<slot*> segments_[segments] = { head_ };
+};
+
+}  // namespace detail
+
+// Observes a cancellation source. A default constructed token is never cancelled.
+class cancellation_token {
+public:
+  cancellation_token() noexcept = default;
+
+  bool can_be_cancelled() const noexcept {
+    return state_ != nullptr;
+  }
+
+  bool is_cancellation_requested() const noexcept {
+    return state_ && state_->requested();
+  }
+
+private:
+  friend class cancellation_source;
+  friend class cancellation_registration;
+
+  explicit cancellation_token(std::shared_ptr<detail::cancellation_state> state) noexcept : state_(std::move(state)) {
+  }
+
+  std::shared_ptr<detail::cancellation_state> state_;
+};
+
+class cancellation_source {
+public:
+  cancellation_source() : state_(std::make_shared<detail::cancellation_state>()) {
+  }
+
+  cancellation_token token() const noexcept {
+    return cancellation_token{ state_ };
+  }
+
+  // Calls the callbacks of all registrations on the calling thread.
+  // Returns false when cancellation was already requested.
+  bool request_cancellation() noexcept {
+    return state_->request();
+  }
+
+  bool is_cancellation_requested() const noexcept {
+    return state_->requested();
+  }
+
+private:
+  std::shared_ptr<detail::cancellation_state> state_;
+};
+
+// Intrusive callback that is called once when cancellation of the token is requested.
+// Awaitables derive from it so that cancelling removes their waiter and resumes it right away.
+class cancellation_registration {
+public:
+  using callback_type = void (*)(cancellation_registration& registration) noexcept;
+
+  explicit cancellation_registration(callback_type callback) noexcept : callback_(callback) {
+  }
+
+  cancellation_registration(cancellation_registration&& other) = delete;
+  cancellation_registration& operator=(cancellation_registration&& other) = delete;
+
+  cancellation_registration(const cancellation_registration& other) = delete;
+  cancellation_registration& operator=(const cancellation_registration& other) = delete;
+
+  ~cancellation_registration() {
+    reset();
+  }
+
+  // Registers the callback. Returns false without calling it when cancellation was already requested.
+  bool start(const cancellation_token& token) {
+    reset();
+    if (!token.state_) {
+      return true;
+    }
+    if (!token.state_->add(*this)) {
+      return false;
+    }
+    state_ = token.state_;
+    return true;
+  }
+
+  // Removes the callback. Waits for the callback to return when it is running on another thread.
+  void reset() noexcept {
+    if (state_) {
+      state_->remove(*this);
+      state_.reset();
+    }
+  }
+
+private:
+  friend class detail::cancellation_state;
+
+  callback_type callback_ = nullptr;
+  std::shared_ptr<detail::cancellation_state> state_;
+  std::uint32_t slot_ = 0;
+};
+
+}  // namespace ssh
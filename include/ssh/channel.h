@@ -0,0 +1,99 @@
+#pragma once
+#include <ssh/async.h>
+#include <ssh/config.h>
+#include <ssh/context.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+typedef struct ssh_session_struct* ssh_session;
+typedef struct ssh_channel_struct* ssh_channel;
+
+struct ssh_channel_callbacks_struct;
+
+namespace ssh {
+
+class session;
+
+// Session channel that shares the transport of an ssh::session with other channels.
+// Readers are resumed by the session only when their channel receives data.
+class channel {
+public:
+  explicit channel(ssh::session& session);
+
+  channel(channel&& other) = delete;
+  channel& operator=(channel&& other) = delete;
+
+  channel(const channel& other) = delete;
+  channel& operator=(const channel& other) = delete;
+
+  virtual ~channel();
+
+  // Opens the channel and executes the command.
+  ssh::async<void> exec(std::string command);
+
+  // Opens the channel and starts a shell.
+  ssh::async<void> shell();
+
+  // Reads available data from the standard output or standard error stream.
+  // Returns 0 when the remote side sent end of file.
+  ssh::async<std::size_t> read(char* data, std::size_t size, bool is_stderr = false);
+
+  // Reads available data from either stream, so that neither is buffered without bound while the other is read.
+  // Sets is_stderr to the stream that was read. Returns 0 when the remote side sent end of file.
+  ssh::async<std::size_t> read_any(char* data, std::size_t size, bool& is_stderr);
+
+  // Writes all data and resumes when it was passed to the socket.
+  ssh::async<void> write(std::string_view data);
+
+  // Sends end of file.
+  ssh::async<void> send_eof();
+
+  // Waits for the exit status, closes the channel and returns the exit status or -1 when the
+  // remote side did not send one. Data that was not read before is discarded.
+  ssh::async<int> close();
+
+  ssh::session& session() noexcept {
+    return session_;
+  }
+
+  ssh_channel handle() noexcept {
+    return handle_.get();
+  }
+
+  const ssh_channel handle() const noexcept {
+    return handle_.get();
+  }
+
+private:
+  friend class session;
+
+  ssh::async<void> open();
+
+  // Marks the channel ready and moves a waiting reader to the ready list of the session.
+  void notify() noexcept;
+
+  static int on_data(ssh_session session, ssh_channel channel, void* data, std::uint32_t size, int is_stderr, void* userdata) noexcept;
+  static void on_eof(ssh_session session, ssh_channel channel, void* userdata) noexcept;
+  static void on_close(ssh_session session, ssh_channel channel, void* userdata) noexcept;
+  static void on_exit_status(ssh_session session, ssh_channel channel, int status, void* userdata) noexcept;
+
+  ssh::session& session_;
+  std::unique_ptr<ssh_channel_struct, void (*)(ssh_channel)> handle_;
+  std::unique_ptr<ssh_channel_callbacks_struct> callbacks_;
+
+  // Waiting reader and its position in the reader lists of the session.
+  ssh::context::work work_;
+  channel* prev_ = nullptr;
+  channel* next_ = nullptr;
+  bool reading_ = false;
+  bool queued_ = false;
+  bool ready_ = false;
+  int stream_ = 0;
+
+  int exit_status_ = -1;
+  bool closed_ = false;
+};
+
+}  // namespace ssh
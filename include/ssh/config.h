@@ -27,3 +27,11 @@
 #ifndef SSH_OS_UNIX
 #define SSH_OS_UNIX 0
 #endif
+
+// Contexts are run by a single thread. Context internals and the state of mutexes, events, semaphores,
+// latches and shared mutexes use plain loads and stores, so each of these must only be used by coroutines
+// of one context. Coroutines can still move between contexts with schedule(), and ssh::async results
+// and when_all/when_any counters stay atomic for that.
+#ifndef SSH_SINGLE_THREADED
+#define SSH_SINGLE_THREADED 0
+#endif
@@ -1,15 +1,131 @@
 #pragma once
 #include <ssh/async.h>
 #include <ssh/handle.h>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <cstdint>
 
 namespace ssh {
 
 class event;
+class uring;
+class timer_wheel;
+
+enum class backend {
+  native,
+  uring,
+};
 
 class context {
 public:
-  context();
+  class worker;
+
+  // Timer wheel of a worker or of the context.
+  struct timers;
+
+  // Intrusive run queue entry of a suspended coroutine.
+  // The owner is the worker that suspended the coroutine and is preferred when the entry is resumed.
+  struct work {
+    coroutine_handle<> handle;
+    worker* owner = nullptr;
+    work* next = nullptr;
+  };
+
+  using clock = std::chrono::steady_clock;
+
+  // Runtime counters. Every worker thread only updates its own counters, so that recording them
+  // costs a plain load and store. Calls from threads that do not run the context are counted separately.
+  struct metrics {
+    constexpr static std::size_t buckets = 24;
+
+    // Calls to epoll_wait, kevent, io_uring_enter or GetQueuedCompletionStatusEx.
+    std::uint64_t waits = 0;
+
+    // Events and completions that were dispatched after a wait.
+    std::uint64_t events = 0;
+
+    // Waits after which no event, timer or queued coroutine was dispatched.
+    std::uint64_t empty_wakeups = 0;
+
+    std::uint64_t interrupts = 0;
+    std::uint64_t schedules = 0;
+
+    // Histograms of the time spent in a wait and the time spent dispatching after it. Only recorded
+    // after measure(true), because they read the clock twice per wait.
+    // Bucket 0 counts durations below 1 us and bucket n durations in [2^(n-1), 2^n) us.
+    std::array<std::uint64_t, buckets> blocked = {};
+    std::array<std::uint64_t, buckets> dispatching = {};
+
+    metrics& operator+=(const metrics& other) noexcept;
+  };
+
+  // Intrusive timer wheel entry. Must not be moved or destroyed while it is scheduled.
+  // The callback is called from run() on the thread that expired the timer, which is the worker that started it
+  // while that worker is in run().
+  class timer {
+  public:
+    using callback_type = void (*)(timer& timer) noexcept;
+
+    explicit timer(callback_type callback) noexcept : callback_(callback) {
+    }
+
+    timer(timer&& other) = delete;
+    timer& operator=(timer&& other) = delete;
+
+    timer(const timer& other) = delete;
+    timer& operator=(const timer& other) = delete;
+
+  private:
+    friend class context;
+    friend class timer_wheel;
+
+    callback_type callback_ = nullptr;
+    std::atomic<timers*> wheel_ = nullptr;
+    timer* prev_ = nullptr;
+    timer* next_ = nullptr;
+    std::uint64_t expiry_ = 0;
+    std::uint8_t level_ = 0;
+    std::uint8_t slot_ = 0;
+    bool scheduled_ = false;
+  };
+
+  class timer_operation : public timer {
+  public:
+    timer_operation(ssh::context& context, clock::time_point time) noexcept : timer(complete), context_(context), time_(time) {
+    }
+
+    constexpr bool await_ready() const noexcept {
+      return false;
+    }
+
+    bool await_suspend(coroutine_handle<> handle) noexcept {
+      work_.handle = handle;
+      work_.owner = ssh::context::current();
+      return context_.start(*this, time_);
+    }
+
+    constexpr void await_resume() const noexcept {
+    }
+
+  private:
+    static void complete(timer& timer) noexcept {
+      auto& operation = static_cast<timer_operation&>(timer);
+      operation.context_.resume(&operation.work_);
+    }
+
+    ssh::context& context_;
+    clock::time_point time_;
+    work work_;
+  };
+
+  // The uring backend is only available on Linux and falls back to native when the kernel does not support it.
+  explicit context(ssh::backend backend = ssh::backend::native);
 
   context(context&& other) = delete;
   context& operator=(context&& other) = delete;
@@ -23,13 +139,123 @@ public:
     return handle_.valid();
   }
 
+  using failure_handler = std::function<void(const ssh::failure& failure)>;
+
+  // Sets the handler for exceptions that escaped detached tasks on the workers of this context. Workers queue
+  // failures without locks and call the handler after dispatching, one worker at a time, so it must not block.
+  // Without a handler, failures are written to stderr by a background thread. Must not be called during run().
+  void set(failure_handler handler);
+
+  // Runs the context on the calling thread. Every thread that calls run() becomes a worker with a
+  // local run queue and steals from other workers when idle. The size is the wait batch length.
+  // Single-threaded builds throw EBUSY when another thread is already running the context. Other threads
+  // can still post to, interrupt and stop it. Their posts wake it up without checking whether it sleeps.
   void run(std::size_t size = 1);
 
   void interrupt() noexcept;
   bool stop() noexcept;
   void reset() noexcept;
 
-  ssh::async<void> schedule() noexcept;
+  class schedule_operation {
+  public:
+    explicit schedule_operation(ssh::context& context) noexcept : context_(context) {
+    }
+
+    constexpr bool await_ready() const noexcept {
+      return false;
+    }
+
+    void await_suspend(coroutine_handle<> handle) noexcept {
+      work_.handle = handle;
+      context_.post(&work_);
+    }
+
+    constexpr void await_resume() const noexcept {
+    }
+
+  private:
+    ssh::context& context_;
+    work work_;
+  };
+
+  // Resumes the awaiting coroutine from the run queue.
+  // Called from a worker, the coroutine is queued locally. Called from a worker of another context, it is passed
+  // through a bounded ring that only this worker writes to. Otherwise it is queued on the shared run queue.
+  // Does not enter the kernel unless a thread is blocked in run().
+  schedule_operation schedule() noexcept {
+    return schedule_operation{ *this };
+  }
+
+  // Calls the callable on the target context. Called from a worker of any context, the call is passed
+  // to the target through the ring of that worker. Exceptions are handled like in ssh::task.
+  template <typename Callable>
+  static void post(ssh::context& target, Callable callable) {
+    [](ssh::context& target, Callable callable) -> ssh::task {
+      co_await target.schedule();
+      callable();
+    }(target, std::move(callable));
+  }
+
+  // Resumes the awaiting coroutine when the duration elapsed.
+  timer_operation sleep(clock::duration duration) noexcept {
+    return timer_operation{ *this, clock::now() + duration };
+  }
+
+  // Resumes the awaiting coroutine at the given time point.
+  timer_operation at(clock::time_point time) noexcept {
+    return timer_operation{ *this, time };
+  }
+
+  // Schedules the timer. Returns false when the time point has already passed.
+  // Timers have a resolution of one millisecond and never expire early.
+  bool start(timer& timer, clock::time_point time) noexcept;
+
+  // Cancels the timer. Returns false when the timer is not scheduled or has already expired.
+  bool cancel(timer& timer) noexcept;
+
+  ssh::backend backend() const noexcept {
+#if SSH_OS_LINUX
+    return uring_ ? ssh::backend::uring : ssh::backend::native;
+#else
+    return ssh::backend::native;
+#endif
+  }
+
+#if SSH_OS_LINUX
+  ssh::uring* uring() noexcept {
+    return uring_.get();
+  }
+#endif
+
+  // Destroys the object once every worker started a new wait. Events that a worker received before the
+  // object was removed from the context may still be processed until then.
+  template <typename T>
+  void retire(T* object) {
+    retire(object, [](void* object) noexcept { delete static_cast<T*>(object); });
+  }
+
+  void retire(void* object, void (*destroy)(void* object) noexcept);
+
+  // Queues a run queue entry from any thread.
+  void post(work* work) noexcept;
+
+  // Queues the entry once every worker started a new wait. Used to resume a coroutine whose event
+  // was cancelled, because an event that another worker already received still references its frame.
+  void defer(work* work);
+
+  // Returns the worker of the calling thread or nullptr when the thread is not in run().
+  static worker* current() noexcept;
+
+  // Enables or disables the blocked and dispatching histograms. Workers pick up the change after their next wait.
+  void measure(bool enable) noexcept {
+    measure_.store(enable, std::memory_order_relaxed);
+  }
+
+  // Returns the sum of the counters of all threads that ran the context and of calls from other threads.
+  ssh::context::metrics snapshot() const noexcept;
+
+  // Returns the counters of every thread that ran the context without calls from other threads.
+  std::vector<ssh::context::metrics> snapshot_workers() const;
 
   ssh::handle& handle() noexcept {
     return handle_;
@@ -40,9 +266,63 @@ public:
   }
 
 private:
+  class channel;
+
+  struct retired {
+    void* object = nullptr;
+    void (*destroy)(void* object) noexcept = nullptr;
+    std::uint64_t epoch = 0;
+  };
+
+  worker& attach() noexcept;
+  void detach(worker& worker) noexcept;
+
+  void push(work* work) noexcept;
+  bool push(worker& source, work* work) noexcept;
+  // Returns true when a post has to interrupt a worker that may be blocked in a wait.
+  bool sleeping() const noexcept;
+
+  bool pending() const noexcept;
+  void resume(work* work) noexcept;
+  void resume(work* work, worker& self) noexcept;
+  bool dispatch(worker& self) noexcept;
+  bool steal(worker& self) noexcept;
+
+  std::uint64_t tick(clock::time_point time, bool round_up) const noexcept;
+  int timeout(worker& self) noexcept;
+  bool expire(worker& self) noexcept;
+  // Returns true when deferred entries are left.
+  bool reclaim() noexcept;
+
+  // Passes queued failures to the handler or to the background reporter.
+  void report() noexcept;
+
   std::atomic_uint32_t state_ = 0;
+  std::atomic_uint32_t sleeping_ = 0;
+  std::atomic_bool notified_ = false;
+  std::atomic<work*> queue_ = nullptr;
+  std::atomic<worker*> workers_ = nullptr;
+  std::atomic<channel*> channels_ = nullptr;
+  const std::uint64_t id_;
+  std::atomic_uint64_t interrupts_ = 0;
+  std::atomic_uint64_t schedules_ = 0;
+  std::atomic_bool measure_ = false;
+  // Timers that are started outside of the workers or left behind by a worker that returned from run().
+  std::unique_ptr<timers> timers_;
+  std::atomic_uint64_t epoch_ = 1;
+  std::atomic_size_t retired_size_ = 0;
+  std::atomic_size_t deferred_ = 0;
+  std::mutex retired_mutex_;
+  std::vector<retired> retired_;
+  detail::failure_queue failures_;
+  std::atomic_bool reporting_ = false;
+  failure_handler failure_handler_;
+  clock::time_point start_ = clock::now();
   ssh::handle handle_;
   ssh::handle events_;
+#if SSH_OS_LINUX
+  std::unique_ptr<ssh::uring> uring_;
+#endif
 };
 
 const std::error_category& context_category() noexcept;
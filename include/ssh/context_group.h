@@ -0,0 +1,110 @@
+#pragma once
+#include <ssh/context.h>
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+namespace ssh {
+
+// Shared-nothing group of contexts with one context per CPU. Every context is run by a single thread
+// that is pinned to its CPU. Sessions are assigned to a shard once and must only be used on its context.
+class context_group {
+public:
+  struct options {
+    // Number of contexts. Zero creates one context per CPU that the process may run on.
+    std::size_t size = 0;
+
+    // Pins the thread of every context to one CPU.
+    bool pin = true;
+
+    ssh::backend backend = ssh::backend::native;
+
+    // Wait batch length of every context.
+    std::size_t batch = 64;
+  };
+
+private:
+  struct shard;
+
+public:
+  // Assignment of a session to a shard. The shard load is decremented when the lease is destroyed.
+  // Start the session with co_await lease.context().schedule() so that it runs on its shard.
+  class lease {
+  public:
+    lease() noexcept = default;
+
+    lease(lease&& other) noexcept : shard_(std::exchange(other.shard_, nullptr)) {
+    }
+
+    lease& operator=(lease&& other) noexcept;
+
+    lease(const lease& other) = delete;
+    lease& operator=(const lease& other) = delete;
+
+    ~lease();
+
+    ssh::context& context() noexcept;
+    std::size_t index() const noexcept;
+
+    explicit operator bool() const noexcept {
+      return shard_ != nullptr;
+    }
+
+  private:
+    friend class context_group;
+
+    explicit lease(shard& shard) noexcept;
+
+    shard* shard_ = nullptr;
+  };
+
+  context_group();
+  explicit context_group(options options);
+
+  context_group(context_group&& other) = delete;
+  context_group& operator=(context_group&& other) = delete;
+
+  context_group(const context_group& other) = delete;
+  context_group& operator=(const context_group& other) = delete;
+
+  // Assigns a session to the shard of the host, so that sessions to the same host share a context.
+  lease acquire(std::string_view host);
+
+  // Assigns a session to the shard with the fewest sessions.
+  lease acquire();
+
+  // Runs every context on its own thread and returns when all of them stopped. The group must not be
+  // destroyed before. Rethrows the first exception that was thrown by a context and stops the others.
+  void run();
+
+  // Requests all contexts to stop. Can be called from any thread.
+  void stop() noexcept;
+
+  std::size_t size() const noexcept {
+    return shards_.size();
+  }
+
+  ssh::context& context(std::size_t index) noexcept;
+
+  // Returns the number of sessions that are assigned to the shard.
+  std::size_t load(std::size_t index) const noexcept;
+
+private:
+  struct shard {
+    shard(ssh::backend backend, std::size_t index, int cpu) : context(backend), index(index), cpu(cpu) {
+    }
+
+    ssh::context context;
+    std::size_t index = 0;
+    int cpu = -1;
+    alignas(64) std::atomic_size_t load = 0;
+  };
+
+  options options_;
+  std::vector<std::unique_ptr<shard>> shards_;
+};
+
+}  // namespace ssh
@@ -1,6 +1,7 @@
 #pragma once
 #include <exception>
 #include <stdexcept>
+#include <string>
 #include <system_error>
 
 namespace ssh {
@@ -26,4 +27,8 @@ inline void throw_error(T ev, const char* message) {
   }
 }
 
-}  // namespace ice
+inline std::string format(const std::error_code& ec) {
+  return std::string(ec.category().name()) + " error " + std::to_string(ec.value()) + ": " + ec.message();
+}
+
+}  // namespace ssh
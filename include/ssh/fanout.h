@@ -0,0 +1,67 @@
+#pragma once
+#include <ssh/async.h>
+#include <ssh/cancellation.h>
+#include <ssh/context.h>
+#include <ssh/session.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace ssh {
+
+class session_pool;
+
+// Executes a command on many hosts with a bounded number of connect, authenticate and execute
+// pipelines in flight. Results are streamed in completion order.
+class fanout {
+public:
+  struct options {
+    // Maximum number of pipelines in flight and therefore open sessions.
+    std::size_t concurrency = 64;
+
+    // Maximum number of bytes captured per stream and host. Additional output is discarded.
+    std::size_t output = 1 << 20;
+
+    std::uint16_t port = 22;
+    ssh::identity identity;
+
+    // Optional pool that sessions are acquired from and returned to.
+    ssh::session_pool* pool = nullptr;
+
+    // Cancels the pipelines that are still running, for example when a deadline expired.
+    // Their results contain the cancellation error. Pooled sessions that were in use are closed.
+    ssh::cancellation_token token;
+  };
+
+  struct result {
+    std::string host;
+    std::string output;
+    std::string error_output;
+
+    // Exit status of the command or -1 when the remote side did not send one.
+    int exit_status = -1;
+
+    // Error message when the pipeline failed.
+    std::string error;
+  };
+
+  explicit fanout(ssh::context& context);
+  fanout(ssh::context& context, options options);
+
+  // Starts the pipelines and yields each result as soon as its pipeline finished.
+  // New pipelines are started when results are consumed, so at most options.concurrency results are buffered.
+  ssh::async_generator<result> run(std::vector<std::string> hosts, std::string command);
+
+private:
+  class state;
+
+  static ssh::task pipeline(std::shared_ptr<state> state, std::string host);
+  static ssh::async<void> execute(const state& state, ssh::session& session, result& result);
+
+  ssh::context& context_;
+  options options_;
+};
+
+}  // namespace ssh
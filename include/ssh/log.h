@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+namespace ssh::log {
+
+// Raises the libssh log level of all threads that run a context and installs the logging callback on them.
+// Libssh keeps both per thread. Called by session::set(ssh::verbosity) with the libssh level.
+// Threads that log append records to their own lock-free ring and never wait for the output.
+// Records are written by a background thread and dropped when the ring of a thread is full.
+void install(int level);
+
+// Applies the installed level and callback to the calling thread when they changed.
+// Called by context::run on every iteration.
+void attach() noexcept;
+
+// Writes records to the end of the file instead of stderr. Throws when the file cannot be opened.
+void open(const std::string& filename);
+
+// Waits until the records that were logged before the call are written.
+void flush();
+
+// Returns the number of records that were dropped because the ring of the logging thread was full.
+std::uint64_t dropped() noexcept;
+
+}  // namespace ssh::log
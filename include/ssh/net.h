@@ -0,0 +1,221 @@
+#pragma once
+#include <ssh/async.h>
+#include <ssh/cancellation.h>
+#include <ssh/config.h>
+#include <ssh/context.h>
+#include <ssh/handle.h>
+#include <ssh/result.h>
+#include <array>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#if !SSH_OS_WIN32
+
+struct sockaddr;
+
+namespace ssh {
+
+class registration;
+
+namespace net {
+
+// IPv4 or IPv6 socket address.
+class endpoint {
+public:
+  endpoint() noexcept = default;
+
+  endpoint(const std::string& host, std::uint16_t port) {
+    create(host, port);
+  }
+
+  // Parses a numeric IPv4 or IPv6 address. Host names are not resolved, because that would block the context.
+  void create(const std::string& host, std::uint16_t port);
+
+  // Returns false instead of throwing when the host is not a numeric address.
+  bool create(ssh::noerror_tag, const std::string& host, std::uint16_t port) noexcept;
+
+  int family() const noexcept;
+  std::string host() const;
+  std::uint16_t port() const noexcept;
+
+  sockaddr* data() noexcept {
+    return reinterpret_cast<sockaddr*>(storage_.data());
+  }
+
+  const sockaddr* data() const noexcept {
+    return reinterpret_cast<const sockaddr*>(storage_.data());
+  }
+
+  std::uint32_t size() const noexcept {
+    return size_;
+  }
+
+  void resize(std::uint32_t size) noexcept {
+    size_ = size;
+  }
+
+  constexpr std::uint32_t capacity() const noexcept {
+    return static_cast<std::uint32_t>(storage_.size());
+  }
+
+private:
+  alignas(8) std::array<unsigned char, 128> storage_ = {};
+  std::uint32_t size_ = 0;
+};
+
+// Buffer with the layout of iovec for vectored receive and send operations.
+struct buffer {
+  void* data = nullptr;
+  std::size_t size = 0;
+};
+
+namespace option {
+
+struct value {
+  int level = 0;
+  int name = 0;
+  int data = 0;
+};
+
+value nodelay(bool enable) noexcept;
+value reuseaddr(bool enable) noexcept;
+
+// Allows several listeners, for example one per context, to bind the same endpoint.
+// The kernel distributes incoming connections between them.
+value reuseport(bool enable) noexcept;
+
+value keepalive(bool enable) noexcept;
+value recv_buffer_size(int size) noexcept;
+value send_buffer_size(int size) noexcept;
+
+}  // namespace option
+
+namespace tcp {
+
+// Non-blocking TCP socket. The descriptor is registered with the context on the first operation that has to wait.
+// Operations on one direction must not overlap and the socket must not be moved while an operation is pending.
+class socket {
+public:
+  explicit socket(ssh::context& context) noexcept;
+
+  // Takes ownership of a non-blocking socket.
+  socket(ssh::context& context, ssh::handle handle) noexcept;
+
+  socket(socket&& other) noexcept;
+  socket& operator=(socket&& other) noexcept;
+
+  socket(const socket& other) = delete;
+  socket& operator=(const socket& other) = delete;
+
+  ~socket();
+
+  void create(int family);
+  void set(const ssh::net::option::value& option);
+  void bind(const ssh::net::endpoint& endpoint);
+
+  // A negative backlog uses SOMAXCONN.
+  void listen(int backlog = -1);
+
+  // Operations that wait for readiness throw ECANCELED when cancellation of the token is requested.
+  // The socket stays registered and can be used or closed afterwards. The overloads that take ssh::noerror
+  // return system errors and ECANCELED in the result instead.
+
+  // Creates the socket when necessary and connects without blocking the context.
+  ssh::async<void> connect(ssh::net::endpoint endpoint, ssh::cancellation_token token = {});
+  ssh::async<ssh::result<void>> connect(ssh::noerror_tag, ssh::net::endpoint endpoint, ssh::cancellation_token token = {});
+
+  // Yields accepted connections until an error is thrown. Every readiness notification drains the
+  // backlog until accept4 reports EAGAIN, so that a burst of connections costs a single wakeup.
+  ssh::async_generator<socket> accept(ssh::cancellation_token token = {});
+
+  // Resume when the socket is ready and return the pending socket error.
+  ssh::async<std::error_code> await_recv(ssh::cancellation_token token = {});
+  ssh::async<std::error_code> await_send(ssh::cancellation_token token = {});
+  ssh::async<ssh::result<void>> await_recv(ssh::noerror_tag, ssh::cancellation_token token = {});
+  ssh::async<ssh::result<void>> await_send(ssh::noerror_tag, ssh::cancellation_token token = {});
+
+  // Receives available data. Returns an empty view or 0 when the remote side closed the connection.
+  ssh::async<std::string_view> recv(char* data, std::size_t size, ssh::cancellation_token token = {});
+  ssh::async<std::size_t> recv(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token = {});
+  ssh::async<ssh::result<std::string_view>> recv(ssh::noerror_tag, char* data, std::size_t size, ssh::cancellation_token token = {});
+  ssh::async<ssh::result<std::size_t>> recv(ssh::noerror_tag, const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token = {});
+
+  template <typename Buffer>
+  ssh::async<std::string_view> recv(Buffer& buffer, ssh::cancellation_token token = {}) {
+    return recv(std::data(buffer), std::size(buffer), std::move(token));
+  }
+
+  template <typename Buffer>
+  ssh::async<ssh::result<std::string_view>> recv(ssh::noerror_tag, Buffer& buffer, ssh::cancellation_token token = {}) {
+    return recv(ssh::noerror, std::data(buffer), std::size(buffer), std::move(token));
+  }
+
+  // Sends all data and returns the number of bytes sent.
+  ssh::async<std::size_t> send(std::string_view data, ssh::cancellation_token token = {});
+  ssh::async<std::size_t> send(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token = {});
+  ssh::async<ssh::result<std::size_t>> send(ssh::noerror_tag, std::string_view data, ssh::cancellation_token token = {});
+  ssh::async<ssh::result<std::size_t>> send(ssh::noerror_tag, const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token = {});
+
+  // Shuts down the send direction.
+  void shutdown();
+  void close() noexcept;
+
+  // Removes the socket from the context and returns the descriptor, for example to pass it to libssh.
+  ssh::handle release() noexcept;
+
+  ssh::net::endpoint local() const;
+  ssh::net::endpoint remote() const;
+
+  ssh::context& context() noexcept {
+    return *context_;
+  }
+
+  ssh::handle& handle() noexcept {
+    return handle_;
+  }
+
+  const ssh::handle& handle() const noexcept {
+    return handle_;
+  }
+
+private:
+  // Operations are implemented once for the throwing and the non-throwing result type.
+  template <typename Result>
+  Result create(int family);
+
+  template <typename Result>
+  ssh::async<Result> connect(ssh::net::endpoint endpoint, ssh::cancellation_token token);
+
+  template <typename Result>
+  ssh::async<Result> await(bool send, ssh::cancellation_token token);
+
+  template <typename Result>
+  ssh::async<Result> recv(char* data, std::size_t size, ssh::cancellation_token token);
+
+  template <typename Result>
+  ssh::async<Result> recv(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token);
+
+  template <typename Result>
+  ssh::async<Result> send(std::string_view data, ssh::cancellation_token token);
+
+  template <typename Result>
+  ssh::async<Result> send(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token);
+
+  ssh::registration& registration();
+
+  ssh::context* context_ = nullptr;
+  ssh::handle handle_;
+  std::unique_ptr<ssh::registration> registration_;
+};
+
+}  // namespace tcp
+}  // namespace net
+}  // namespace ssh
+
+#endif
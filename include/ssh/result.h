@@ -0,0 +1,127 @@
+#pragma once
+#include <ssh/exception.h>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace ssh {
+
+// Value or error returned by the non-throwing overloads that take ssh::noerror.
+// Errors that are expected outcomes, like a refused connection, are returned without unwinding.
+template <typename T>
+class result {
+public:
+  static_assert(!std::is_reference_v<T> && !std::is_same_v<std::decay_t<T>, std::error_code>);
+
+  using value_type = T;
+
+  result(T value) noexcept(std::is_nothrow_move_constructible_v<T>) : value_(std::in_place_index<0>, std::move(value)) {
+  }
+
+  result(std::error_code ec) noexcept : value_(std::in_place_index<1>, ec) {
+  }
+
+  bool has_value() const noexcept {
+    return value_.index() == 0;
+  }
+
+  explicit operator bool() const noexcept {
+    return has_value();
+  }
+
+  // Throws the error when the result has no value.
+  T& value() & {
+    check();
+    return *std::get_if<0>(&value_);
+  }
+
+  const T& value() const& {
+    check();
+    return *std::get_if<0>(&value_);
+  }
+
+  T&& value() && {
+    check();
+    return std::move(*std::get_if<0>(&value_));
+  }
+
+  T& operator*() & noexcept {
+    return *std::get_if<0>(&value_);
+  }
+
+  const T& operator*() const& noexcept {
+    return *std::get_if<0>(&value_);
+  }
+
+  T&& operator*() && noexcept {
+    return std::move(*std::get_if<0>(&value_));
+  }
+
+  T* operator->() noexcept {
+    return std::get_if<0>(&value_);
+  }
+
+  const T* operator->() const noexcept {
+    return std::get_if<0>(&value_);
+  }
+
+  // Returns an empty error code when the result has a value.
+  std::error_code error() const noexcept {
+    const auto ec = std::get_if<1>(&value_);
+    return ec ? *ec : std::error_code{};
+  }
+
+private:
+  void check() const {
+    if (const auto ec = std::get_if<1>(&value_)) {
+      throw ssh::system_error(*ec);
+    }
+  }
+
+  std::variant<T, std::error_code> value_;
+};
+
+template <>
+class result<void> {
+public:
+  using value_type = void;
+
+  result() noexcept = default;
+
+  result(std::error_code ec) noexcept : error_(ec) {
+  }
+
+  bool has_value() const noexcept {
+    return !error_;
+  }
+
+  explicit operator bool() const noexcept {
+    return has_value();
+  }
+
+  // Throws the error when the result has no value.
+  void value() const {
+    if (error_) {
+      throw ssh::system_error(error_);
+    }
+  }
+
+  std::error_code error() const noexcept {
+    return error_;
+  }
+
+private:
+  std::error_code error_;
+};
+
+template <typename T>
+struct is_result : std::false_type {};
+
+template <typename T>
+struct is_result<result<T>> : std::true_type {};
+
+template <typename T>
+constexpr inline bool is_result_v = is_result<T>::value;
+
+}  // namespace ssh
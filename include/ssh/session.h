@@ -1,11 +1,30 @@
 #pragma once
+#include <ssh/async.h>
+#include <ssh/cancellation.h>
 #include <ssh/config.h>
+#include <ssh/context.h>
+#include <ssh/exception.h>
+#include <ssh/result.h>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <cstdint>
 
 typedef struct ssh_session_struct* ssh_session;
 
 namespace ssh {
 
+class channel;
+
+#if !SSH_OS_WIN32
+class registration;
+
+namespace net::tcp {
+class socket;
+}  // namespace net::tcp
+#endif
+
 enum class verbosity {
   nolog,
   warning,
@@ -14,21 +33,83 @@ enum class verbosity {
   functions,
 };
 
+enum class auth_result {
+  success,
+  partial,
+  denied,
+};
+
+// Credentials tried by session::authenticate in the order agent, public key, password.
+// Methods with empty values are skipped. An empty user name uses the session user.
+struct identity {
+  std::string user;
+  bool agent = false;
+  std::string key;
+  std::string passphrase;
+  std::string password;
+};
+
+// A session and its channels must not be used from multiple threads at the same time.
+// The session must outlive its channels and pending operations.
 class session {
 public:
   explicit session(ssh::context& context);
 
-  session(session&& other) noexcept = default;
-  session& operator=(session&& other) noexcept = default;
+  session(session&& other) = delete;
+  session& operator=(session&& other) = delete;
 
   session(const session& other) = delete;
   session& operator=(const session& other) = delete;
 
-  virtual ~session() = default;
+  virtual ~session();
 
+  // Libssh keeps the log level per thread. Threads that run a context use the highest verbosity of all
+  // sessions and write records through the ssh::log background thread.
   void set(ssh::verbosity verbosity);
 
-  ssh::async<void> connect(const net::endpoint& endpoint);
+  // Pending and later operations of the session and its channels throw ECANCELED once cancellation of
+  // the token is requested. The session can only be destroyed afterwards. Can be replaced with an empty token.
+  void set(ssh::cancellation_token token);
+
+  // Connects to the host and performs the key exchange without blocking the context. Numeric addresses are
+  // connected with ssh::net::tcp::socket, so that connection errors keep their errno. Host names are resolved
+  // and connected by libssh, which reports every connection failure as SSH_FATAL.
+  ssh::async<void> connect(std::string host, std::uint16_t port = 22);
+
+#if !SSH_OS_WIN32
+  // Performs the key exchange over a connected socket, which is closed by libssh with the session.
+  // The host name and the remote port are used to look up the host key.
+  ssh::async<void> connect(ssh::net::tcp::socket socket, std::string host);
+#endif
+
+  // Authentication methods resume with partial when the server requires additional methods.
+  // Errors other than a denied authentication are thrown.
+  ssh::async<ssh::auth_result> auth_password(std::string user, std::string password);
+  ssh::async<ssh::auth_result> auth_publickey(std::string user, std::string key, std::string passphrase = {});
+  ssh::async<ssh::auth_result> auth_agent(std::string user);
+
+  // Tries the identity methods in order until one succeeds. Methods the server did not list in
+  // a previous failure are skipped, so no separate "none" request is sent to query them.
+  ssh::async<ssh::auth_result> authenticate(ssh::identity identity);
+
+  // Resumes when all pending output was written to the socket.
+  ssh::async<void> flush();
+
+  // Overloads that return errors instead of throwing them. Libssh errors are reported in ssh::session_category()
+  // and their message is available from ssh_get_error until the next call. Cancellation is reported as ECANCELED.
+  ssh::async<ssh::result<void>> connect(ssh::noerror_tag, std::string host, std::uint16_t port = 22);
+#if !SSH_OS_WIN32
+  ssh::async<ssh::result<void>> connect(ssh::noerror_tag, ssh::net::tcp::socket socket, std::string host);
+#endif
+  ssh::async<ssh::result<ssh::auth_result>> auth_password(ssh::noerror_tag, std::string user, std::string password);
+  ssh::async<ssh::result<ssh::auth_result>> auth_publickey(ssh::noerror_tag, std::string user, std::string key, std::string passphrase = {});
+  ssh::async<ssh::result<ssh::auth_result>> auth_agent(ssh::noerror_tag, std::string user);
+  ssh::async<ssh::result<ssh::auth_result>> authenticate(ssh::noerror_tag, ssh::identity identity);
+  ssh::async<ssh::result<void>> flush(ssh::noerror_tag);
+
+  ssh::context& context() noexcept {
+    return *context_;
+  }
 
   ssh_session handle() noexcept {
     return handle_.get();
@@ -39,7 +120,152 @@ public:
   }
 
 private:
+  friend class channel;
+
+  // Coroutines waiting for socket readiness in one direction.
+  // A single poll loop per direction waits for the socket and resumes all of them.
+  struct direction {
+    ssh::context::work* waiters = nullptr;
+    bool* alive = nullptr;
+  };
+
+  class wait_operation {
+  public:
+    wait_operation(ssh::session& session, bool send, bool check) noexcept : session_(session), send_(send), check_(check) {
+    }
+
+    bool await_ready() const noexcept {
+      return session_.token_.is_cancellation_requested();
+    }
+
+    void await_suspend(coroutine_handle<> handle) noexcept {
+      work_.handle = handle;
+      work_.owner = ssh::context::current();
+      session_.suspend(work_, send_);
+    }
+
+    void await_resume() const {
+      if (check_) {
+        session_.check();
+      }
+    }
+
+  private:
+    ssh::session& session_;
+    bool send_ = false;
+    bool check_ = true;
+    ssh::context::work work_;
+  };
+
+  class read_operation {
+  public:
+    explicit read_operation(ssh::channel& channel) noexcept : channel_(channel) {
+    }
+
+    bool await_ready() const noexcept;
+    void await_suspend(coroutine_handle<> handle) noexcept;
+    void await_resume() const;
+
+  private:
+    ssh::channel& channel_;
+  };
+
+  // Wakes up the poll loops when cancellation is requested.
+  class canceller final : public ssh::cancellation_registration {
+  public:
+    explicit canceller(ssh::session& session) noexcept : cancellation_registration(complete), session_(session) {
+    }
+
+  private:
+    static void complete(cancellation_registration& registration) noexcept;
+
+    ssh::session& session_;
+  };
+
+  // Resumes when the session socket is ready in the direction libssh is waiting for.
+  // The caller repeats the libssh call that returned SSH_AGAIN.
+  wait_operation wait() noexcept;
+
+  // Does not throw when cancellation was requested. The caller checks the token.
+  wait_operation wait(ssh::noerror_tag) noexcept;
+
+  // Resumes when the channel received data, end of file, an exit status or was closed.
+  read_operation read(ssh::channel& channel) noexcept {
+    return read_operation{ channel };
+  }
+
+  // Clears the cached readiness of the direction after libssh returned SSH_AGAIN. Libssh polls the socket itself
+  // before it reads or writes, so SSH_AGAIN means that the readiness the poll loop observed was used up.
+  void clear(bool send) noexcept;
+
+  // Clears the direction and waits in its poll loop. Called after libssh returned SSH_AGAIN.
+  void suspend(ssh::context::work& work, bool send) noexcept;
+
+  // Waits for socket readiness and resumes the waiting coroutines until none are left.
+  // The receive loop also processes incoming packets for channels with a waiting reader.
+  ssh::task poll(bool send);
+
+  // Moves the channel from the list of waiting readers to the list of ready readers.
+  void ready(ssh::channel& channel) noexcept;
+
+  // Removes the channel from the list of waiting or ready readers.
+  void remove(ssh::channel& channel) noexcept;
+
+  // Queues ready readers on the context. Called after every libssh call that can process incoming packets.
+  void notify() noexcept;
+
+  // Operations are implemented once for the throwing and the non-throwing result type.
+  template <typename Result>
+  ssh::async<Result> connect(std::string host, std::uint16_t port);
+
+#if !SSH_OS_WIN32
+  template <typename Result>
+  ssh::async<Result> connect(ssh::net::tcp::socket socket, std::string host);
+#endif
+
+  template <typename Result>
+  ssh::async<Result> auth_password(std::string user, std::string password);
+
+  template <typename Result>
+  ssh::async<Result> auth_publickey(std::string user, std::string key, std::string passphrase);
+
+  template <typename Result>
+  ssh::async<Result> auth_agent(std::string user);
+
+  template <typename Result>
+  ssh::async<Result> authenticate(ssh::identity identity);
+
+  template <typename Result>
+  ssh::async<Result> flush();
+
+  template <typename Result>
+  ssh::async<Result> handshake();
+
+  // Throws ECANCELED when cancellation of the session was requested.
+  void check() const;
+
+  // Wakes up the poll loops. Can be called from any thread.
+  void wake() noexcept;
+
+  // Returns true when the server allows the method or has not sent a list of methods yet.
+  bool allowed(int method) noexcept;
+
+  ssh::context* context_ = nullptr;
   std::unique_ptr<ssh_session_struct, void (*)(ssh_session)> handle_;
+#if !SSH_OS_WIN32
+  // Guards the registration against the cancellation callback, which can run on any thread.
+  std::mutex registration_mutex_;
+  std::unique_ptr<ssh::registration> registration_;
+#endif
+  ssh::cancellation_token token_;
+  canceller canceller_{ *this };
+  direction recv_;
+  direction send_;
+  ssh::channel* readers_ = nullptr;
+  ssh::channel* ready_ = nullptr;
 };
 
+// Category of libssh errors returned by the non-throwing session overloads.
+const std::error_category& session_category() noexcept;
+
 }  // namespace ssh
@@ -0,0 +1,206 @@
+#pragma once
+#include <ssh/async.h>
+#include <ssh/context.h>
+#include <ssh/session.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace ssh {
+
+// Pool of connected and authenticated sessions keyed by host, port and identity.
+// The pool must outlive its leases and pending operations.
+class session_pool {
+public:
+  using clock = ssh::context::clock;
+
+  struct options {
+    // Maximum number of sessions per host including sessions that are still connecting.
+    std::size_t limit = 16;
+
+    // Number of idle sessions kept per key once the key was acquired.
+    std::size_t warm = 0;
+
+    // Idle sessions are closed after this duration. Zero keeps idle sessions and disables the periodic sweep.
+    clock::duration idle = std::chrono::minutes(1);
+
+    // Sessions are closed instead of reused after this duration.
+    clock::duration age = std::chrono::minutes(10);
+  };
+
+  struct key {
+    std::string host;
+    std::uint16_t port = 22;
+    ssh::identity identity;
+
+    bool operator==(const key& other) const noexcept;
+  };
+
+private:
+  struct host;
+  struct bucket;
+
+  struct entry {
+    std::unique_ptr<ssh::session> session;
+    session_pool::bucket* bucket = nullptr;
+    clock::time_point created;
+    clock::time_point used;
+  };
+
+public:
+  // Session handed out by the pool. Returns the session to the pool when destroyed.
+  class lease {
+  public:
+    lease() noexcept = default;
+
+    lease(lease&& other) noexcept = default;
+    lease& operator=(lease&& other) noexcept;
+
+    lease(const lease& other) = delete;
+    lease& operator=(const lease& other) = delete;
+
+    ~lease();
+
+    // Closes the session instead of returning it to the pool when the lease is destroyed.
+    void discard() noexcept {
+      reuse_ = false;
+    }
+
+    ssh::session& session() noexcept {
+      return *entry_->session;
+    }
+
+    ssh::session* operator->() noexcept {
+      return entry_->session.get();
+    }
+
+    explicit operator bool() const noexcept {
+      return entry_ != nullptr;
+    }
+
+  private:
+    friend class session_pool;
+
+    lease(session_pool& pool, std::unique_ptr<entry> entry) noexcept : pool_(&pool), entry_(std::move(entry)) {
+    }
+
+    session_pool* pool_ = nullptr;
+    std::unique_ptr<entry> entry_;
+    bool reuse_ = true;
+  };
+
+  explicit session_pool(ssh::context& context);
+  session_pool(ssh::context& context, options options);
+
+  session_pool(session_pool&& other) = delete;
+  session_pool& operator=(session_pool&& other) = delete;
+
+  session_pool(const session_pool& other) = delete;
+  session_pool& operator=(const session_pool& other) = delete;
+
+  ~session_pool();
+
+  // Returns the most recently used idle session for the key or connects a new one.
+  // When the host limit is reached, an idle session of another key on the same host is closed
+  // or the call waits until a session of the host is returned.
+  ssh::async<lease> acquire(key key);
+
+  // Connects sessions until the key has the warm number of idle sessions.
+  ssh::async<void> warm(key key);
+
+  // Closes idle sessions that exceeded the idle duration or age and returns their number.
+  std::size_t expire();
+
+  std::size_t size() const noexcept;
+  std::size_t idle() const noexcept;
+
+private:
+  struct key_hash {
+    std::size_t operator()(const key& key) const noexcept;
+  };
+
+  class wait_operation {
+  public:
+    wait_operation(session_pool::host& host, std::unique_lock<std::mutex>& lock) noexcept : host_(host), lock_(lock) {
+    }
+
+    constexpr bool await_ready() const noexcept {
+      return false;
+    }
+
+    void await_suspend(coroutine_handle<> handle) noexcept;
+
+    constexpr void await_resume() const noexcept {
+    }
+
+  private:
+    session_pool::host& host_;
+    std::unique_lock<std::mutex>& lock_;
+    ssh::context::work work_;
+  };
+
+  class sweeper final : public ssh::context::timer {
+  public:
+    explicit sweeper(session_pool& pool) noexcept : timer(complete), pool_(pool) {
+    }
+
+    void start() noexcept;
+
+    // Cancels the timer and waits for a callback that already expired on another thread.
+    void stop() noexcept;
+
+  private:
+    static void complete(timer& timer) noexcept;
+
+    session_pool& pool_;
+
+    // Set while the timer is scheduled or its callback is running.
+    std::atomic_bool armed_ = false;
+    std::atomic_bool stopping_ = false;
+  };
+
+  struct host {
+    std::size_t size = 0;
+    std::vector<session_pool::bucket*> buckets;
+    ssh::context::work* waiters = nullptr;
+  };
+
+  struct bucket {
+    session_pool::host* host = nullptr;
+    std::vector<std::unique_ptr<entry>> idle;
+    std::size_t connecting = 0;
+  };
+
+  // Returns the bucket of the key and creates it when necessary. Must be called with the mutex locked.
+  bucket& find(const key& key);
+
+  ssh::async<std::unique_ptr<entry>> connect(bucket& bucket, key key);
+
+  // Connects one session in the background and adds it to the idle sessions.
+  ssh::task fill(bucket& bucket, key key);
+
+  // Returns a session to the pool or closes it.
+  void release(std::unique_ptr<entry> entry, bool reuse) noexcept;
+
+  // Frees a slot of the host and returns a waiter that must be resumed after the lock is released.
+  ssh::context::work* free(host& host) noexcept;
+
+  bool usable(const entry& entry, clock::time_point now) const noexcept;
+
+  ssh::context& context_;
+  options options_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, host> hosts_;
+  std::unordered_map<key, bucket, key_hash> buckets_;
+  std::size_t size_ = 0;
+  std::size_t idle_ = 0;
+  sweeper sweeper_;
+};
+
+}  // namespace ssh
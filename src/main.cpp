@@ -1,5 +1,6 @@
-#include <ice/context.h>
-#include <ice/ssh/session.h>
+#include <ssh/context.h>
+#include <ssh/net.h>
+#include <ssh/session.h>
 #include <array>
 #include <iostream>
 
@@ -8,10 +9,16 @@
 #if 1
 
 ssh::task start(ssh::context& context) {
-  ssh::ssh::session session(context);
-  session.set(ssh::ssh::verbosity::functions);
+  try {
+    ssh::session session(context);
+    session.set(ssh::verbosity::functions);
+    // A numeric address is connected without the blocking resolver of libssh.
+    co_await session.connect("127.0.0.1");
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+  }
   context.stop();
-  co_return;
 }
 
 // clang-format on
@@ -51,6 +58,7 @@ ssh::task start(ssh::context& context) {
   ssh::net::tcp::socket server(context);
   server.create(endpoint.family());
   server.set(ssh::net::option::reuseaddr(true));
+  server.set(ssh::net::option::reuseport(true));
   server.bind(endpoint);
   server.listen();
   for co_await(auto&& client : server.accept()) {
@@ -63,17 +71,13 @@ ssh::task start(ssh::context& context) {
 #endif
 
 int main(int argc, char* argv[]) {
-  std::error_code ec;
-  ssh::context context;
-  context.create(ec);
-  if (ec) {
-    std::cerr << ssh::format(ec) << std::endl;
-    return ec.value();
+  try {
+    ssh::context context;
+    start(context);
+    context.run();
   }
-  start(context);
-  context.run(ec);
-  if (ec) {
-    std::cerr << ssh::format(ec) << std::endl;
-    return ec.value();
+  catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
   }
 }
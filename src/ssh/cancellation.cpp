@@ -0,0 +1,125 @@
+#include <ssh/cancellation.h>
+#include <new>
+
+namespace ssh::detail {
+namespace {
+
+constexpr std::uint64_t index_mask = 0xFFFFFFFF;
+
+// Segment k starts at index base * (2^k - 1).
+constexpr std::size_t segment_of(std::uint32_t index, std::size_t base) noexcept {
+  std::size_t segment = 0;
+  for (auto position = index / base + 1; position > 1; position >>= 1) {
+    segment++;
+  }
+  return segment;
+}
+
+constexpr std::uint64_t tagged(std::uint64_t head, std::uint64_t link) noexcept {
+  return ((head >> 32) + 1) << 32 | link;
+}
+
+}  // namespace
+
+cancellation_state::~cancellation_state() {
+  for (std::size_t i = 1; i < segments; i++) {
+    delete[] segments_[i].load(std::memory_order_relaxed);
+  }
+}
+
+bool cancellation_state::request() noexcept {
+  if (requested_.exchange(true)) {
+    return false;
+  }
+  thread_.store(std::this_thread::get_id(), std::memory_order_release);
+  for (std::size_t i = 0; i < segments; i++) {
+    // Segments may be published out of order when adds race.
+    const auto segment = segments_[i].load();
+    if (!segment) {
+      continue;
+    }
+    for (std::size_t j = 0, size = base << i; j < size; j++) {
+      auto& slot = segment[j];
+      // A registration added after the flag was set removes itself, unless it is taken here first.
+      for (auto registration = slot.registration.load(); registration; registration = slot.registration.load()) {
+        running_.store(registration);
+        if (slot.registration.compare_exchange_strong(registration, nullptr)) {
+          // The callback may destroy the registration when it runs on the thread that owns it.
+          registration->callback_(*registration);
+          running_.store(nullptr, std::memory_order_release);
+          break;
+        }
+        running_.store(nullptr, std::memory_order_release);
+      }
+    }
+  }
+  return true;
+}
+
+bool cancellation_state::add(cancellation_registration& registration) {
+  if (requested_.load()) {
+    return false;
+  }
+  const auto index = acquire();
+  auto& slot = at(index);
+  slot.registration.store(&registration);
+  registration.slot_ = index;
+  // Either request() sees the registration or the flag is seen here. The callback is called when
+  // request() took the registration first.
+  if (auto expected = &registration; requested_.load() && slot.registration.compare_exchange_strong(expected, nullptr)) {
+    release(index);
+    return false;
+  }
+  return true;
+}
+
+void cancellation_state::remove(cancellation_registration& registration) noexcept {
+  if (auto expected = &registration; at(registration.slot_).registration.compare_exchange_strong(expected, nullptr)) {
+    release(registration.slot_);
+    return;
+  }
+  // The registration was taken by request(). Callbacks only wake up or post the waiter, so waiting for them spins.
+  if (thread_.load(std::memory_order_acquire) != std::this_thread::get_id()) {
+    while (running_.load(std::memory_order_acquire) == &registration) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+cancellation_state::slot& cancellation_state::at(std::uint32_t index) noexcept {
+  const auto segment = segment_of(index, base);
+  return segments_[segment].load(std::memory_order_acquire)[index + base - (base << segment)];
+}
+
+std::uint32_t cancellation_state::acquire() {
+  auto head = free_.load(std::memory_order_acquire);
+  while (head & index_mask) {
+    const auto index = static_cast<std::uint32_t>((head & index_mask) - 1);
+    const auto next = at(index).next.load(std::memory_order_relaxed);
+    if (free_.compare_exchange_weak(head, tagged(head, next), std::memory_order_acquire, std::memory_order_acquire)) {
+      return index;
+    }
+  }
+  const auto index = size_.fetch_add(1, std::memory_order_relaxed);
+  const auto segment = segment_of(index, base);
+  if (segment >= segments) {
+    throw std::bad_alloc();
+  }
+  if (!segments_[segment].load(std::memory_order_acquire)) {
+    auto created = std::make_unique<slot[]>(base << segment);
+    if (slot* expected = nullptr; segments_[segment].compare_exchange_strong(expected, created.get())) {
+      created.release();
+    }
+  }
+  return index;
+}
+
+void cancellation_state::release(std::uint32_t index) noexcept {
+  auto& slot = at(index);
+  auto head = free_.load(std::memory_order_relaxed);
+  do {
+    slot.next.store(static_cast<std::uint32_t>(head & index_mask), std::memory_order_relaxed);
+  } while (!free_.compare_exchange_weak(head, tagged(head, index + 1), std::memory_order_release, std::memory_order_relaxed));
+}
+
+}  // namespace ssh::detail
@@ -0,0 +1,193 @@
+#include <ssh/channel.h>
+#include <ssh/exception.h>
+#include <ssh/session.h>
+#include <libssh/callbacks.h>
+#include <libssh/libssh.h>
+#include <algorithm>
+#include <limits>
+
+namespace ssh {
+
+channel::channel(ssh::session& session) :
+  session_(session), handle_(::ssh_channel_new(session.handle()), ::ssh_channel_free), callbacks_(std::make_unique<ssh_channel_callbacks_struct>()) {
+  if (!handle_) {
+    throw ssh::domain_error(ssh_get_error(session.handle()));
+  }
+  ssh_callbacks_init(callbacks_.get());
+  callbacks_->userdata = this;
+  callbacks_->channel_data_function = on_data;
+  callbacks_->channel_eof_function = on_eof;
+  callbacks_->channel_close_function = on_close;
+  callbacks_->channel_exit_status_function = on_exit_status;
+  if (ssh_set_channel_callbacks(handle(), callbacks_.get()) != SSH_OK) {
+    throw ssh::domain_error(ssh_get_error(session.handle()));
+  }
+}
+
+channel::~channel() {
+  if (reading_ || queued_) {
+    session_.remove(*this);
+  }
+  ssh_remove_channel_callbacks(handle(), callbacks_.get());
+}
+
+ssh::async<void> channel::exec(std::string command) {
+  co_await open();
+  while (true) {
+    const auto rc = ssh_channel_request_exec(handle(), command.c_str());
+    session_.notify();
+    if (rc == SSH_OK) {
+      break;
+    }
+    if (rc != SSH_AGAIN) {
+      throw ssh::domain_error(ssh_get_error(session_.handle()));
+    }
+    co_await session_.wait();
+  }
+}
+
+ssh::async<void> channel::shell() {
+  co_await open();
+  while (true) {
+    const auto rc = ssh_channel_request_shell(handle());
+    session_.notify();
+    if (rc == SSH_OK) {
+      break;
+    }
+    if (rc != SSH_AGAIN) {
+      throw ssh::domain_error(ssh_get_error(session_.handle()));
+    }
+    co_await session_.wait();
+  }
+}
+
+ssh::async<std::size_t> channel::read(char* data, std::size_t size, bool is_stderr) {
+  const auto limit = static_cast<std::uint32_t>(std::min<std::size_t>(size, std::numeric_limits<std::uint32_t>::max()));
+  while (true) {
+    ready_ = false;
+    const auto rc = ssh_channel_read_nonblocking(handle(), data, limit, is_stderr ? 1 : 0);
+    session_.notify();
+    if (rc > 0) {
+      co_return static_cast<std::size_t>(rc);
+    }
+    if (rc == SSH_EOF || (rc == 0 && ssh_channel_is_eof(handle()))) {
+      co_return 0;
+    }
+    if (rc < 0) {
+      throw ssh::domain_error(ssh_get_error(session_.handle()));
+    }
+    stream_ = is_stderr ? 1 : 0;
+    co_await session_.read(*this);
+  }
+}
+
+ssh::async<std::size_t> channel::read_any(char* data, std::size_t size, bool& is_stderr) {
+  const auto limit = static_cast<std::uint32_t>(std::min<std::size_t>(size, std::numeric_limits<std::uint32_t>::max()));
+  while (true) {
+    ready_ = false;
+    // Data that arrived before the end of file is buffered once the flag is set.
+    const auto eof = ssh_channel_is_eof(handle()) != 0;
+    for (const auto stream : { 1, 0 }) {
+      const auto rc = ssh_channel_read_nonblocking(handle(), data, limit, stream);
+      session_.notify();
+      if (rc > 0) {
+        is_stderr = stream == 1;
+        co_return static_cast<std::size_t>(rc);
+      }
+      if (rc < 0 && rc != SSH_EOF) {
+        throw ssh::domain_error(ssh_get_error(session_.handle()));
+      }
+    }
+    if (eof) {
+      co_return 0;
+    }
+    stream_ = 0;
+    co_await session_.read(*this);
+  }
+}
+
+ssh::async<void> channel::write(std::string_view data) {
+  while (!data.empty()) {
+    const auto size = static_cast<std::uint32_t>(std::min<std::size_t>(data.size(), std::numeric_limits<std::uint32_t>::max()));
+    const auto rc = ssh_channel_write(handle(), data.data(), size);
+    session_.notify();
+    if (rc < 0) {
+      throw ssh::domain_error(ssh_get_error(session_.handle()));
+    }
+    data.remove_prefix(static_cast<std::size_t>(rc));
+    if (!data.empty()) {
+      // The remote window is exhausted or the socket is full.
+      co_await session_.wait();
+    }
+  }
+  co_await session_.flush();
+}
+
+ssh::async<void> channel::send_eof() {
+  if (ssh_channel_send_eof(handle()) != SSH_OK) {
+    throw ssh::domain_error(ssh_get_error(session_.handle()));
+  }
+  co_await session_.flush();
+}
+
+ssh::async<int> channel::close() {
+  while (exit_status_ < 0 && !closed_ && ssh_channel_is_open(handle())) {
+    // Processes incoming packets without blocking until the exit status or close message arrives.
+    ssh_channel_get_exit_status(handle());
+    session_.notify();
+    if (exit_status_ >= 0 || closed_) {
+      break;
+    }
+    co_await session_.wait();
+  }
+  if (ssh_channel_is_open(handle()) && ssh_channel_close(handle()) != SSH_OK) {
+    throw ssh::domain_error(ssh_get_error(session_.handle()));
+  }
+  co_await session_.flush();
+  co_return exit_status_;
+}
+
+ssh::async<void> channel::open() {
+  while (true) {
+    const auto rc = ssh_channel_open_session(handle());
+    session_.notify();
+    if (rc == SSH_OK) {
+      break;
+    }
+    if (rc != SSH_AGAIN) {
+      throw ssh::domain_error(ssh_get_error(session_.handle()));
+    }
+    co_await session_.wait();
+  }
+}
+
+void channel::notify() noexcept {
+  ready_ = true;
+  if (reading_) {
+    session_.ready(*this);
+  }
+}
+
+int channel::on_data(ssh_session session, ssh_channel channel, void* data, std::uint32_t size, int is_stderr, void* userdata) noexcept {
+  // The data is left in the channel buffer and consumed by read.
+  static_cast<ssh::channel*>(userdata)->notify();
+  return 0;
+}
+
+void channel::on_eof(ssh_session session, ssh_channel channel, void* userdata) noexcept {
+  static_cast<ssh::channel*>(userdata)->notify();
+}
+
+void channel::on_close(ssh_session session, ssh_channel channel, void* userdata) noexcept {
+  const auto self = static_cast<ssh::channel*>(userdata);
+  self->closed_ = true;
+  self->notify();
+}
+
+void channel::on_exit_status(ssh_session session, ssh_channel channel, int status, void* userdata) noexcept {
+  const auto self = static_cast<ssh::channel*>(userdata);
+  self->exit_status_ = status;
+  self->notify();
+}
+
+}  // namespace ssh
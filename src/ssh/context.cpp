@@ -1,6 +1,13 @@
 #include <ssh/context.h>
 #include <ssh/event.h>
 #include <ssh/exception.h>
+#include <ssh/log.h>
+#include <ssh/timer.h>
+#include <ssh/uring.h>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <memory>
 #include <vector>
 #include <cassert>
 #include <cstdint>
@@ -37,9 +44,212 @@ public:
 };
 #endif
 
+// Bounded FIFO run queue of a worker. Only the owner pushes. Any worker pops.
+// Single-threaded contexts have no other workers that could steal, so the indices are plain values.
+class local_queue {
+public:
+  bool push(context::work* work) noexcept {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= capacity) {
+      return false;
+    }
+    buffer_[tail & mask].store(work, std::memory_order_relaxed);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  context::work* pop() noexcept {
+    auto head = head_.load(std::memory_order_acquire);
+    while (head != tail_.load(std::memory_order_acquire)) {
+      const auto work = buffer_[head & mask].load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return work;
+      }
+    }
+    return nullptr;
+  }
+
+  std::uint32_t size() const noexcept {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const noexcept {
+    return size() == 0;
+  }
+
+private:
+  constexpr static std::uint32_t capacity = 256;
+  constexpr static std::uint32_t mask = capacity - 1;
+
+  detail::atomic<std::uint32_t> head_ = 0;
+  detail::atomic<std::uint32_t> tail_ = 0;
+  std::array<detail::atomic<context::work*>, capacity> buffer_ = {};
+};
+
+// Reverses a list that was built by pushing to the front.
+context::work* reverse(context::work* head) noexcept {
+  context::work* list = nullptr;
+  while (head) {
+    const auto next = head->next;
+    head->next = list;
+    list = head;
+    head = next;
+  }
+  return list;
+}
+
+thread_local context::worker* g_worker = nullptr;
+
+// Identifies contexts in the channel routes of workers, because a new context can reuse the address of a destroyed one.
+std::atomic_uint64_t g_context_id = 0;
+
+// Increments a counter that is only written by one thread.
+void increment(std::atomic_uint64_t& counter, std::uint64_t value = 1) noexcept {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+std::size_t bucket(context::clock::duration duration) noexcept {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  std::size_t index = 0;
+  while (us > 0 && index < context::metrics::buckets - 1) {
+    us >>= 1;
+    index++;
+  }
+  return index;
+}
+
 }  // namespace
 
-context::context() {
+context::metrics& context::metrics::operator+=(const metrics& other) noexcept {
+  waits += other.waits;
+  events += other.events;
+  empty_wakeups += other.empty_wakeups;
+  interrupts += other.interrupts;
+  schedules += other.schedules;
+  for (std::size_t i = 0; i < buckets; i++) {
+    blocked[i] += other.blocked[i];
+    dispatching[i] += other.dispatching[i];
+  }
+  return *this;
+}
+
+// Bounded single-producer single-consumer ring from one worker of another context to this context.
+// The producer is the thread that is attached to that worker. Workers of this context take turns as the consumer.
+class context::channel {
+public:
+  bool push(work* work) noexcept {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= capacity) {
+      return false;
+    }
+    buffer_[tail & mask] = work;
+    // Ordered before the sleeping state is read, see context::run().
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+    return true;
+  }
+
+  context::work* pop() noexcept {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    const auto work = buffer_[head & mask];
+    head_.store(head + 1, std::memory_order_release);
+    return work;
+  }
+
+  bool empty() const noexcept {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_seq_cst);
+  }
+
+  channel* next = nullptr;
+
+  // Held by the worker that drains the ring.
+  std::atomic_bool consuming = false;
+
+  // Set by the producer when it woke up the context and cleared before the ring is drained.
+  std::atomic_bool signaled = false;
+
+private:
+  constexpr static std::uint32_t capacity = 256;
+  constexpr static std::uint32_t mask = capacity - 1;
+
+  alignas(64) std::atomic_uint32_t head_ = 0;
+  alignas(64) std::atomic_uint32_t tail_ = 0;
+  std::array<context::work*, capacity> buffer_ = {};
+};
+
+// Timer wheel and the lock that guards it. Every worker starts and expires timers in its own wheel, so the
+// lock is only contended when a timer is cancelled from another thread.
+struct context::timers {
+  std::mutex mutex;
+  ssh::timer_wheel wheel;
+  std::atomic_size_t size = 0;
+};
+
+// Workers are owned by the context and reused by later run() calls, so that owner pointers in
+// suspended run queue entries stay valid for the lifetime of the context.
+class context::worker {
+public:
+  explicit worker(ssh::context& context) noexcept : context(context) {
+  }
+
+  // Queues an entry from another thread.
+  void post(work* work) noexcept {
+    auto head = inbox.load(std::memory_order_relaxed);
+    do {
+      work->next = head;
+    } while (!inbox.compare_exchange_weak(head, work, std::memory_order_seq_cst, std::memory_order_relaxed));
+  }
+
+  ssh::context::metrics snapshot() const noexcept {
+    ssh::context::metrics metrics;
+    metrics.waits = waits.load(std::memory_order_relaxed);
+    metrics.events = events.load(std::memory_order_relaxed);
+    metrics.empty_wakeups = empty_wakeups.load(std::memory_order_relaxed);
+    metrics.interrupts = interrupts.load(std::memory_order_relaxed);
+    metrics.schedules = schedules.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < metrics::buckets; i++) {
+      metrics.blocked[i] = blocked[i].load(std::memory_order_relaxed);
+      metrics.dispatching[i] = dispatching[i].load(std::memory_order_relaxed);
+    }
+    return metrics;
+  }
+
+  ssh::context& context;
+  worker* next = nullptr;
+  detail::atomic<bool> attached = false;
+  detail::atomic<bool> awake = false;
+  detail::atomic<work*> inbox = nullptr;
+  local_queue queue;
+  context::timers timers;
+#if SSH_OS_LINUX
+  // Timeout operation of the io_uring backend. Workers are never deleted before the context.
+  __kernel_timespec timeout = {};
+#endif
+
+  // Rings to other contexts that this worker is the producer of.
+  struct route {
+    std::uint64_t id = 0;
+    context::channel* channel = nullptr;
+  };
+
+  std::vector<route> routes;
+
+  // Value of the context epoch before the last wait or 0 when no thread is attached.
+  std::atomic_uint64_t epoch = 0;
+
+  // Counters that are only written by the thread that is attached to the worker.
+  std::atomic_uint64_t waits = 0;
+  std::atomic_uint64_t events = 0;
+  std::atomic_uint64_t empty_wakeups = 0;
+  std::atomic_uint64_t interrupts = 0;
+  std::atomic_uint64_t schedules = 0;
+  std::array<std::atomic_uint64_t, metrics::buckets> blocked = {};
+  std::array<std::atomic_uint64_t, metrics::buckets> dispatching = {};
+};
+
+context::context(ssh::backend backend) : id_(g_context_id.fetch_add(1, std::memory_order_relaxed) + 1), timers_(std::make_unique<timers>()) {
 #if SSH_OS_WIN32
   static library library;
   handle_.reset(::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0));
@@ -60,6 +270,9 @@ context::context() {
   if (::epoll_ctl(handle_.value(), EPOLL_CTL_ADD, events_.value(), &nev) < 0) {
     throw_error(errno, "epoll_ctl");
   }
+  if (backend == ssh::backend::uring) {
+    uring_ = ssh::uring::create(*this);
+  }
 #elif SSH_OS_FREEBSD
   handle_.reset(::kqueue());
   if (!handle_) {
@@ -77,6 +290,18 @@ context::~context() {
   [[maybe_unused]] const auto state = state_.fetch_or(stop_requested_flag, std::memory_order_release);
   [[maybe_unused]] const auto thread_count = state / thread_count_increment;
   assert(thread_count == 0);
+  report();
+  for (auto worker = workers_.load(std::memory_order_acquire); worker;) {
+    delete std::exchange(worker, worker->next);
+  }
+  for (const auto& entry : retired_) {
+    if (entry.destroy) {
+      entry.destroy(entry.object);
+    }
+  }
+  for (auto channel = channels_.load(std::memory_order_acquire); channel;) {
+    delete std::exchange(channel, channel->next);
+  }
 }
 
 void context::run(std::size_t size) {
@@ -91,46 +316,144 @@ void context::run(std::size_t size) {
   std::vector<data_type> events(size);
   const auto events_data = events.data();
   const auto events_size = static_cast<size_type>(events.size());
+#if SSH_SINGLE_THREADED
+  if (state_.fetch_add(thread_count_increment, std::memory_order_relaxed) / thread_count_increment > 0) {
+    state_.fetch_sub(thread_count_increment, std::memory_order_relaxed);
+    throw_error(EBUSY, "run");
+  }
+#else
   state_.fetch_add(thread_count_increment, std::memory_order_relaxed);
+#endif
+  auto& self = attach();
+  const auto previous = std::exchange(g_worker, &self);
+  const auto previous_failures = std::exchange(detail::current_failure_queue(), &failures_);
+  const auto wakeup = [&]() noexcept {
+#if !SSH_SINGLE_THREADED
+    sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    self.awake.store(true, std::memory_order_seq_cst);
+    notified_.store(false, std::memory_order_relaxed);
+#endif
+  };
+  auto measured = measure_.load(std::memory_order_relaxed);
+  auto tp0 = measured ? clock::now() : clock::time_point();
   while ((state_.load(std::memory_order_acquire) & stop_requested_flag) == 0) {
+    ssh::log::attach();
+#if SSH_SINGLE_THREADED
+    // Objects that are retired after this point cannot be referenced by the events of the next wait.
+    // Releasing the epoch orders the previous dispatch before the reclamation by another thread.
+    self.epoch.store(epoch_.load(std::memory_order_acquire), std::memory_order_release);
+
+    // The sleeping state is not published. Posts from other threads always interrupt instead.
+#else
+    // Objects that are retired after this point cannot be referenced by the events of the next wait.
+    self.epoch.store(epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+
+    // Only block when all run queues are empty. The sleeping state is published before the queues
+    // are checked so that a post either sees a sleeping thread or the thread sees the post.
+    self.awake.store(false, std::memory_order_seq_cst);
+    sleeping_.fetch_add(1, std::memory_order_seq_cst);
+#endif
+    const auto block = self.queue.empty() && !self.inbox.load(std::memory_order_seq_cst) && !queue_.load(std::memory_order_seq_cst) && !pending() && !deferred_.load(std::memory_order_seq_cst);
+    const auto milliseconds = block ? timeout(self) : 0;
 #if SSH_OS_WIN32
     size_type count = 0;
-    if (!::GetQueuedCompletionStatusEx(handle_.as<HANDLE>(), events_data, events_size, &count, INFINITE, FALSE)) {
-      if (const auto code = ::GetLastError(); code != ERROR_ABANDONED_WAIT_0) {
+    const auto success = ::GetQueuedCompletionStatusEx(handle_.as<HANDLE>(), events_data, events_size, &count, milliseconds < 0 ? INFINITE : static_cast<DWORD>(milliseconds), FALSE);
+    wakeup();
+    if (!success) {
+      if (const auto code = ::GetLastError(); code != ERROR_ABANDONED_WAIT_0 && code != WAIT_TIMEOUT) {
         error = static_cast<int>(code);
         break;
       }
     }
 #elif SSH_OS_LINUX
-    size_type count = ::epoll_wait(handle_.value(), events_data, events_size, -1);
+    work* completions = nullptr;
+    size_type count = 0;
+    if (uring_) {
+      count = uring_->wait(milliseconds, self.timeout, events_data, events_size, completions);
+    } else {
+      count = ::epoll_wait(handle_.value(), events_data, events_size, milliseconds);
+    }
+    wakeup();
     if (count < 0 && errno != EINTR) {
       error = errno;
       break;
     }
 #elif SSH_OS_FREEBSD
-    size_type count = ::kevent(handle_.value(), nullptr, 0, events_data, events_size, nullptr);
+    const timespec timeout = { milliseconds / 1000, (milliseconds % 1000) * 1000000 };
+    size_type count = ::kevent(handle_.value(), nullptr, 0, events_data, events_size, milliseconds < 0 ? nullptr : &timeout);
+    wakeup();
     if (count < 0 && errno != EINTR) {
       error = errno;
       break;
     }
 #endif
+    increment(self.waits);
+    auto tp1 = tp0;
+    if (measured) {
+      tp1 = clock::now();
+      increment(self.blocked[bucket(tp1 - tp0)]);
+    }
+    std::uint64_t dispatched = 0;
     for (size_type i = 0; i < count; i++) {
       auto& entry = events_data[i];
 #if SSH_OS_WIN32
       if (entry.lpOverlapped) {
-        static_cast<ssh::event*>(entry.lpOverlapped)->resume(entry.dwNumberOfBytesTransferred);
+        resume(static_cast<ssh::event*>(entry.lpOverlapped)->complete(entry.dwNumberOfBytesTransferred), self);
+        dispatched++;
       }
 #elif SSH_OS_LINUX
-      if (entry.data.ptr) {
-        reinterpret_cast<ssh::event*>(entry.data.ptr)->resume();
+      if (const auto data = reinterpret_cast<std::uintptr_t>(entry.data.ptr); data & ssh::registration::tag) {
+        const auto [recv, send] = reinterpret_cast<ssh::registration*>(data & ~ssh::registration::tag)->complete(entry.events);
+        resume(recv, self);
+        resume(send, self);
+        dispatched++;
+      } else if (data) {
+        resume(reinterpret_cast<ssh::event*>(data)->complete(), self);
+        dispatched++;
       }
 #elif SSH_OS_FREEBSD
-      if (entry.udata) {
-        reinterpret_cast<ssh::event*>(entry.udata)->resume();
+      if (const auto data = reinterpret_cast<std::uintptr_t>(entry.udata); data & ssh::registration::tag) {
+        const auto [recv, send] = reinterpret_cast<ssh::registration*>(data & ~ssh::registration::tag)->complete(entry.filter);
+        resume(recv, self);
+        resume(send, self);
+        dispatched++;
+      } else if (data) {
+        resume(reinterpret_cast<ssh::event*>(data)->complete(), self);
+        dispatched++;
       }
 #endif
     }
+#if SSH_OS_LINUX
+    while (completions) {
+      resume(std::exchange(completions, completions->next), self);
+      dispatched++;
+    }
+#endif
+    const auto expired = expire(self);
+    const auto resumed = dispatch(self);
+    if (!dispatched && !expired && !resumed) {
+      increment(self.empty_wakeups);
+    }
+    increment(self.events, dispatched);
+    // Sleeping workers hold back deferred entries until they start a new wait.
+    if (retired_size_.load(std::memory_order_relaxed) && reclaim() && sleeping()) {
+      interrupt();
+    }
+    if (!failures_.empty()) {
+      report();
+    }
+    if (const auto measure = measure_.load(std::memory_order_relaxed); measure || measured) {
+      tp0 = clock::now();
+      if (measured) {
+        increment(self.dispatching[bucket(tp0 - tp1)]);
+      }
+      measured = measure;
+    }
   }
+  g_worker = previous;
+  detail::current_failure_queue() = previous_failures;
+  report();
+  detach(self);
   const auto state = state_.fetch_sub(thread_count_increment, std::memory_order_release);
   const auto stop_requested = state & stop_requested_flag;
   const auto thread_count = state / thread_count_increment;
@@ -141,14 +464,23 @@ void context::run(std::size_t size) {
 }
 
 void context::interrupt() noexcept {
+  if (const auto self = g_worker; self && &self->context == this) {
+    increment(self->interrupts);
+  } else {
+    interrupts_.fetch_add(1, std::memory_order_relaxed);
+  }
 #if SSH_OS_WIN32
   ::PostQueuedCompletionStatus(handle_.as<HANDLE>(), 0, 0, nullptr);
 #elif SSH_OS_LINUX
-  static epoll_event nev = {};
+  // The ring completes a wait without another call to epoll_wait.
+  if (uring_ && uring_->wake()) {
+    return;
+  }
+  epoll_event nev = {};
   nev.events = EPOLLOUT | EPOLLONESHOT;
   ::epoll_ctl(handle_.value(), EPOLL_CTL_MOD, events_.value(), &nev);
 #elif SSH_OS_FREEBSD
-  static struct kevent nev = {};
+  struct kevent nev = {};
   EV_SET(&nev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
   ::kevent(handle_.value(), &nev, 1, nullptr, 0, nullptr);
 #endif
@@ -169,23 +501,416 @@ void context::reset() noexcept {
   assert((state & stop_requested_flag) != 0);
 }
 
-ssh::async<void> context::schedule() noexcept {
-#if SSH_OS_WIN32
-  ssh::event ev;
-  if (!::PostQueuedCompletionStatus(handle_.as<HANDLE>(), 0, 0, ev.get())) {
-    co_return;
+void context::set(failure_handler handler) {
+  failure_handler_ = std::move(handler);
+}
+
+void context::report() noexcept {
+  if (failures_.empty() || reporting_.exchange(true, std::memory_order_acquire)) {
+    return;
   }
-  co_await ev;
-#elif SSH_OS_LINUX
-  const auto fd = ssh::handle(::eventfd(0, EFD_NONBLOCK));
-  if (!fd) {
-    co_return;
+  auto failures = failures_.pop();
+  if (failure_handler_) {
+    while (failures) {
+      const std::unique_ptr<detail::failure_node> node(std::exchange(failures, failures->next));
+      try {
+        failure_handler_(node->failure);
+      }
+      catch (...) {
+      }
+    }
+  } else {
+    detail::report(failures);
   }
-  [[maybe_unused]] const auto code = co_await ssh::event(handle_.value(), fd.value(), SSH_EVENT_SEND);
-#elif SSH_OS_FREEBSD
-  [[maybe_unused]] const auto code = co_await ssh::event(handle_.value(), 0, EVFILT_USER, NOTE_TRIGGER);
+  reporting_.store(false, std::memory_order_release);
+}
+
+void context::retire(void* object, void (*destroy)(void* object) noexcept) {
+  {
+    std::lock_guard lock(retired_mutex_);
+    retired_.push_back({ object, destroy, epoch_.fetch_add(1, std::memory_order_seq_cst) });
+    retired_size_.store(retired_.size(), std::memory_order_relaxed);
+  }
+  reclaim();
+}
+
+void context::defer(work* work) {
+  {
+    std::lock_guard lock(retired_mutex_);
+    retired_.push_back({ work, nullptr, epoch_.fetch_add(1, std::memory_order_seq_cst) });
+    retired_size_.store(retired_.size(), std::memory_order_relaxed);
+    deferred_.fetch_add(1, std::memory_order_seq_cst);
+  }
+  if (reclaim() && sleeping()) {
+    interrupt();
+  }
+}
+
+bool context::reclaim() noexcept {
+  // An entry is released when every attached worker published an epoch that was read after it was retired.
+  auto epoch = std::numeric_limits<std::uint64_t>::max();
+  for (auto worker = workers_.load(std::memory_order_acquire); worker; worker = worker->next) {
+    if (const auto value = worker->epoch.load(std::memory_order_seq_cst); value && value < epoch) {
+      epoch = value;
+    }
+  }
+  std::lock_guard lock(retired_mutex_);
+  const auto it = std::partition(retired_.begin(), retired_.end(), [epoch](const retired& entry) noexcept {
+    return entry.epoch >= epoch;
+  });
+  for (auto entry = it; entry != retired_.end(); ++entry) {
+    if (entry->destroy) {
+      entry->destroy(entry->object);
+    } else {
+      deferred_.fetch_sub(1, std::memory_order_relaxed);
+      push(static_cast<work*>(entry->object));
+    }
+  }
+  retired_.erase(it, retired_.end());
+  retired_size_.store(retired_.size(), std::memory_order_relaxed);
+  return deferred_.load(std::memory_order_relaxed) > 0;
+}
+
+context::worker* context::current() noexcept {
+  return g_worker;
+}
+
+context::metrics context::snapshot() const noexcept {
+  ssh::context::metrics metrics;
+  for (auto worker = workers_.load(std::memory_order_acquire); worker; worker = worker->next) {
+    metrics += worker->snapshot();
+  }
+  metrics.interrupts += interrupts_.load(std::memory_order_relaxed);
+  metrics.schedules += schedules_.load(std::memory_order_relaxed);
+  return metrics;
+}
+
+std::vector<context::metrics> context::snapshot_workers() const {
+  std::vector<ssh::context::metrics> metrics;
+  for (auto worker = workers_.load(std::memory_order_acquire); worker; worker = worker->next) {
+    metrics.push_back(worker->snapshot());
+  }
+  return metrics;
+}
+
+context::worker& context::attach() noexcept {
+  for (auto worker = workers_.load(std::memory_order_acquire); worker; worker = worker->next) {
+    if (!worker->attached.exchange(true, std::memory_order_acquire)) {
+      worker->awake.store(true, std::memory_order_seq_cst);
+      return *worker;
+    }
+  }
+  const auto worker = new context::worker(*this);
+  worker->attached.store(true, std::memory_order_relaxed);
+  worker->awake.store(true, std::memory_order_relaxed);
+  worker->next = workers_.load(std::memory_order_relaxed);
+  while (!workers_.compare_exchange_weak(worker->next, worker, std::memory_order_release, std::memory_order_relaxed)) {
+  }
+  return *worker;
+}
+
+void context::detach(worker& self) noexcept {
+  self.awake.store(false, std::memory_order_seq_cst);
+  // Hand queued entries over to the remaining workers. Entries that are routed to this worker
+  // after this point are either stolen or resumed by the next thread that attaches to it.
+  auto work = reverse(self.inbox.exchange(nullptr, std::memory_order_acquire));
+  while (work) {
+    push(std::exchange(work, work->next));
+  }
+  while (const auto work = self.queue.pop()) {
+    push(work);
+  }
+  // Timers of this worker are expired by the remaining workers or by the next thread in run().
+  if (self.timers.size.load(std::memory_order_relaxed)) {
+    {
+      std::scoped_lock lock(self.timers.mutex, timers_->mutex);
+      for (auto timer = self.timers.wheel.clear(); timer;) {
+        auto& entry = *std::exchange(timer, timer->next_);
+        entry.wheel_.store(timers_.get(), std::memory_order_relaxed);
+        timers_->wheel.insert(entry, entry.expiry_);
+      }
+      self.timers.size.store(0, std::memory_order_relaxed);
+      timers_->size.store(timers_->wheel.size(), std::memory_order_relaxed);
+    }
+    if (sleeping()) {
+      interrupt();
+    }
+  }
+  self.epoch.store(0, std::memory_order_seq_cst);
+  self.attached.store(false, std::memory_order_release);
+}
+
+void context::post(work* work) noexcept {
+  if (const auto self = g_worker; self && &self->context == this) {
+    increment(self->schedules);
+  } else {
+    schedules_.fetch_add(1, std::memory_order_relaxed);
+  }
+  push(work);
+}
+
+void context::push(work* work) noexcept {
+  if (const auto self = g_worker; self && &self->context == this) {
+    if (self->queue.push(work)) {
+      // Wake a sleeping worker to steal when this worker has more than it is about to run.
+      // Only one such wakeup is in flight at a time.
+      if (self->queue.size() > 1 && sleeping() && !notified_.exchange(true, std::memory_order_acq_rel)) {
+        interrupt();
+      }
+      return;
+    }
+  }
+  if (const auto self = g_worker; self && &self->context != this && push(*self, work)) {
+    return;
+  }
+  auto head = queue_.load(std::memory_order_relaxed);
+  do {
+    work->next = head;
+  } while (!queue_.compare_exchange_weak(head, work, std::memory_order_seq_cst, std::memory_order_relaxed));
+  // Only the post that makes the queue non-empty needs to wake a thread. Later posts are
+  // picked up by the same dispatch() call.
+  if (!head && sleeping()) {
+    interrupt();
+  }
+}
+
+bool context::push(worker& source, work* work) noexcept {
+  channel* channel = nullptr;
+  for (const auto& route : source.routes) {
+    if (route.id == id_) {
+      channel = route.channel;
+      break;
+    }
+  }
+  if (!channel) {
+    try {
+      source.routes.reserve(source.routes.size() + 1);
+      channel = new context::channel();
+    }
+    catch (...) {
+      return false;
+    }
+    source.routes.push_back({ id_, channel });
+    channel->next = channels_.load(std::memory_order_relaxed);
+    while (!channels_.compare_exchange_weak(channel->next, channel, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+  }
+  if (!channel->push(work)) {
+    return false;
+  }
+  // Only the first entry after the ring was drained enters the kernel, and only when a worker is asleep.
+  if (sleeping() && !channel->signaled.exchange(true, std::memory_order_acq_rel)) {
+    interrupt();
+  }
+  return true;
+}
+
+bool context::sleeping() const noexcept {
+#if SSH_SINGLE_THREADED
+  const auto self = g_worker;
+  return !self || &self->context != this;
+#else
+  return sleeping_.load(std::memory_order_seq_cst) > 0;
 #endif
-  co_return;
+}
+
+bool context::pending() const noexcept {
+  for (auto channel = channels_.load(std::memory_order_acquire); channel; channel = channel->next) {
+    if (!channel->empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void context::resume(work* work, worker& self) noexcept {
+  if (!work) {
+    return;
+  }
+  // Keep the coroutine on the thread that suspended it when that thread is busy anyway.
+  // A sleeping owner would need a system call to wake up, so the coroutine migrates instead.
+  if (const auto owner = work->owner; owner && owner != &self && &owner->context == this && owner->awake.load(std::memory_order_seq_cst)) {
+    owner->post(work);
+    if (!owner->awake.load(std::memory_order_seq_cst)) {
+      interrupt();
+    }
+    return;
+  }
+  work->owner = &self;
+  work->handle.resume();
+}
+
+void context::resume(work* work) noexcept {
+  if (const auto self = g_worker; self && &self->context == this) {
+    resume(work, *self);
+  } else {
+    work->handle.resume();
+  }
+}
+
+bool context::dispatch(worker& self) noexcept {
+  auto resumed = false;
+
+  // Entries routed to this worker by other threads.
+  auto work = reverse(self.inbox.exchange(nullptr, std::memory_order_acquire));
+  while (work) {
+    std::exchange(work, work->next)->handle.resume();
+    resumed = true;
+  }
+
+  // Entries posted from threads that are not workers of this context.
+  work = reverse(queue_.exchange(nullptr, std::memory_order_acquire));
+  while (work) {
+    const auto next = std::exchange(work->next, nullptr);
+    if (!self.queue.push(work)) {
+      work->handle.resume();
+      resumed = true;
+    }
+    work = next;
+  }
+
+  // Entries posted by workers of other contexts.
+  for (auto channel = channels_.load(std::memory_order_acquire); channel; channel = channel->next) {
+    if (channel->empty() || channel->consuming.exchange(true, std::memory_order_acquire)) {
+      continue;
+    }
+    channel->signaled.store(false, std::memory_order_seq_cst);
+    while (const auto work = channel->pop()) {
+      if (!self.queue.push(work)) {
+        work->handle.resume();
+        resumed = true;
+      }
+    }
+    channel->consuming.store(false, std::memory_order_release);
+  }
+
+  // Entries that are scheduled while dispatching run in the next pass so that events are not starved.
+  for (auto size = self.queue.size(); size > 0; size--) {
+    if (const auto work = self.queue.pop()) {
+      work->handle.resume();
+      resumed = true;
+    }
+  }
+  return resumed || steal(self);
+}
+
+bool context::steal(worker& self) noexcept {
+  for (auto worker = workers_.load(std::memory_order_acquire); worker; worker = worker->next) {
+    if (worker == &self) {
+      continue;
+    }
+    if (const auto work = worker->queue.pop()) {
+      work->owner = &self;
+      work->handle.resume();
+      return true;
+    }
+    if (!worker->awake.load(std::memory_order_seq_cst) && worker->inbox.load(std::memory_order_relaxed)) {
+      auto work = reverse(worker->inbox.exchange(nullptr, std::memory_order_acquire));
+      if (work) {
+        while (work) {
+          std::exchange(work, work->next)->handle.resume();
+        }
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool context::start(timer& timer, clock::time_point time) noexcept {
+  if (time <= clock::now()) {
+    return false;
+  }
+  const auto expiry = tick(time, true);
+  const auto self = g_worker && &g_worker->context == this ? g_worker : nullptr;
+  auto& timers = self ? self->timers : *timers_;
+  auto earliest = false;
+  {
+    std::lock_guard<std::mutex> lock(timers.mutex);
+    assert(!timer.scheduled_);
+    earliest = expiry < timers.wheel.next();
+    timer.wheel_.store(&timers, std::memory_order_relaxed);
+    timers.wheel.insert(timer, expiry);
+    timers.size.store(timers.wheel.size(), std::memory_order_relaxed);
+  }
+  // Workers compute the wait timeout before they block. Only a timer that is started outside of
+  // the workers and expires before the current timeout needs to wake one up.
+  if (!self && earliest && sleeping()) {
+    interrupt();
+  }
+  return true;
+}
+
+bool context::cancel(timer& timer) noexcept {
+  // The timer moves to the wheel of the context when its worker returns from run().
+  auto timers = timer.wheel_.load(std::memory_order_acquire);
+  while (timers) {
+    std::lock_guard<std::mutex> lock(timers->mutex);
+    if (const auto wheel = timer.wheel_.load(std::memory_order_relaxed); wheel != timers) {
+      timers = wheel;
+      continue;
+    }
+    if (!timer.scheduled_) {
+      return false;
+    }
+    timers->wheel.remove(timer);
+    timers->size.store(timers->wheel.size(), std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+std::uint64_t context::tick(clock::time_point time, bool round_up) const noexcept {
+  if (time <= start_) {
+    return 0;
+  }
+  const auto duration = time - start_;
+  auto ticks = std::chrono::duration_cast<std::chrono::milliseconds>(duration);
+  if (round_up && ticks < duration) {
+    ticks += std::chrono::milliseconds(1);
+  }
+  return static_cast<std::uint64_t>(ticks.count());
+}
+
+int context::timeout(worker& self) noexcept {
+  auto next = ssh::timer_wheel::never;
+  for (const auto timers : { &self.timers, timers_.get() }) {
+    if (timers->size.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(timers->mutex);
+      next = std::min(next, timers->wheel.next());
+    }
+  }
+  if (next == ssh::timer_wheel::never) {
+    return -1;
+  }
+  const auto now = tick(clock::now(), false);
+  if (next <= now) {
+    return 0;
+  }
+  return static_cast<int>(std::min<std::uint64_t>(next - now, std::numeric_limits<int>::max()));
+}
+
+bool context::expire(worker& self) noexcept {
+  auto result = false;
+  for (const auto timers : { &self.timers, timers_.get() }) {
+    if (timers->size.load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    const auto now = tick(clock::now(), false);
+    timer* expired = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(timers->mutex);
+      expired = timers->wheel.advance(now);
+      timers->size.store(timers->wheel.size(), std::memory_order_relaxed);
+    }
+    result = result || expired != nullptr;
+    while (expired) {
+      auto& timer = *std::exchange(expired, expired->next_);
+      timer.next_ = nullptr;
+      timer.callback_(timer);
+    }
+  }
+  return result;
 }
 
 class context_category_impl : public std::error_category {
@@ -0,0 +1,206 @@
+#include <ssh/context_group.h>
+#include <ssh/exception.h>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#if SSH_OS_WIN32
+#include <windows.h>
+#elif SSH_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#elif SSH_OS_FREEBSD
+#include <sys/param.h>
+#include <sys/cpuset.h>
+#include <pthread.h>
+#include <pthread_np.h>
+#endif
+
+namespace ssh {
+namespace {
+
+// Returns the CPUs that the process may run on.
+std::vector<int> cpus() {
+  std::vector<int> cpus;
+#if SSH_OS_WIN32
+  DWORD_PTR process = 0;
+  DWORD_PTR system = 0;
+  if (::GetProcessAffinityMask(::GetCurrentProcess(), &process, &system)) {
+    for (int cpu = 0; cpu < static_cast<int>(sizeof(process) * 8); cpu++) {
+      if (process & (static_cast<DWORD_PTR>(1) << cpu)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#elif SSH_OS_LINUX
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#elif SSH_OS_FREEBSD
+  cpuset_t set;
+  CPU_ZERO(&set);
+  if (::cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    cpus.resize(std::max(1u, std::thread::hardware_concurrency()));
+    for (std::size_t i = 0; i < cpus.size(); i++) {
+      cpus[i] = static_cast<int>(i);
+    }
+  }
+  return cpus;
+}
+
+// Pins the calling thread to the CPU.
+void pin(int cpu) {
+#if SSH_OS_WIN32
+  if (!::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu)) {
+    throw_error(::GetLastError(), "SetThreadAffinityMask");
+  }
+#elif SSH_OS_LINUX
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (const auto rv = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set)) {
+    throw_error(rv, "pthread_setaffinity_np");
+  }
+#elif SSH_OS_FREEBSD
+  cpuset_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (const auto rv = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set)) {
+    throw_error(rv, "pthread_setaffinity_np");
+  }
+#endif
+}
+
+}  // namespace
+
+context_group::lease::lease(shard& shard) noexcept : shard_(&shard) {
+  shard_->load.fetch_add(1, std::memory_order_relaxed);
+}
+
+context_group::lease& context_group::lease::operator=(lease&& other) noexcept {
+  if (this != std::addressof(other)) {
+    if (shard_) {
+      shard_->load.fetch_sub(1, std::memory_order_relaxed);
+    }
+    shard_ = std::exchange(other.shard_, nullptr);
+  }
+  return *this;
+}
+
+context_group::lease::~lease() {
+  if (shard_) {
+    shard_->load.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+ssh::context& context_group::lease::context() noexcept {
+  return shard_->context;
+}
+
+std::size_t context_group::lease::index() const noexcept {
+  return shard_->index;
+}
+
+context_group::context_group() : context_group(options{}) {
+}
+
+context_group::context_group(options options) : options_(options) {
+  const auto cpus = ssh::cpus();
+  const auto size = options_.size ? options_.size : cpus.size();
+  shards_.reserve(size);
+  for (std::size_t i = 0; i < size; i++) {
+    shards_.push_back(std::make_unique<shard>(options_.backend, i, cpus[i % cpus.size()]));
+  }
+}
+
+context_group::lease context_group::acquire(std::string_view host) {
+  return lease{ *shards_[std::hash<std::string_view>{}(host) % shards_.size()] };
+}
+
+context_group::lease context_group::acquire() {
+  // The loads are read without synchronization, so concurrent calls may pick the same shard.
+  auto best = shards_.front().get();
+  auto best_load = std::numeric_limits<std::size_t>::max();
+  for (const auto& shard : shards_) {
+    if (const auto load = shard->load.load(std::memory_order_relaxed); load < best_load) {
+      best = shard.get();
+      best_load = load;
+    }
+  }
+  return lease{ *best };
+}
+
+void context_group::run() {
+  std::mutex mutex;
+  std::exception_ptr exception;
+  std::vector<std::thread> threads;
+  threads.reserve(shards_.size());
+  const auto join = [&]() noexcept {
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  };
+  try {
+    for (const auto& entry : shards_) {
+      threads.emplace_back([this, &shard = *entry, &mutex, &exception]() {
+        try {
+          if (options_.pin) {
+            pin(shard.cpu);
+          }
+          shard.context.run(options_.batch);
+        }
+        catch (...) {
+          std::lock_guard lock(mutex);
+          if (!exception) {
+            exception = std::current_exception();
+          }
+          // One failed shard would leave its sessions without a thread, so the whole group stops.
+          stop();
+        }
+      });
+    }
+  }
+  catch (...) {
+    // Threads that are still joinable would terminate the process.
+    stop();
+    join();
+    throw;
+  }
+  join();
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+void context_group::stop() noexcept {
+  for (const auto& shard : shards_) {
+    shard->context.stop();
+  }
+}
+
+ssh::context& context_group::context(std::size_t index) noexcept {
+  return shards_[index]->context;
+}
+
+std::size_t context_group::load(std::size_t index) const noexcept {
+  return shards_[index]->load.load(std::memory_order_relaxed);
+}
+
+}  // namespace ssh
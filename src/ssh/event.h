@@ -1,6 +1,14 @@
 #pragma once
 #include <ssh/async.h>
+#include <ssh/cancellation.h>
+#include <ssh/context.h>
+#include <ssh/exception.h>
+#include <ssh/uring.h>
+#include <atomic>
+#include <memory>
+#include <utility>
 #include <cassert>
+#include <cstdint>
 
 #if SSH_OS_WIN32
 #include <windows.h>
@@ -24,7 +32,11 @@ using event_base = epoll_event;
 using event_base = struct kevent;
 #endif
 
+#if SSH_OS_WIN32
 class event final : public ssh::event_base {
+#else
+class event final : public ssh::event_base, private ssh::cancellation_registration {
+#endif
 public:
   using handle_type = std::experimental::coroutine_handle<>;
 
@@ -32,16 +44,28 @@ public:
   event() noexcept : ssh::event_base({}) {
   }
 #elif SSH_OS_LINUX
-  event(int context, int fd, uint32_t events) noexcept : context_(context), fd_(fd) {
+  event(int context, int fd, uint32_t events) noexcept : cancellation_registration(cancel), context_(context), fd_(fd) {
     const auto ev = static_cast<ssh::event_base*>(this);
     ev->data.ptr = ev;
     ev->events = events;
   }
+
+  // Cancelling removes the event from the context and resumes the awaiting coroutine with ECANCELED.
+  event(ssh::context& context, int fd, uint32_t events, ssh::cancellation_token token) noexcept : event(context.handle().value(), fd, events) {
+    owner_ = &context;
+    token_ = std::move(token);
+  }
 #elif SSH_OS_FREEBSD
-  event(int context, int fd, short filter, unsigned int fflags = 0) noexcept : context_(context) {
+  event(int context, int fd, short filter, unsigned int fflags = 0) noexcept : cancellation_registration(cancel), context_(context) {
     const auto ev = static_cast<ssh::event_base*>(this);
     EV_SET(ev, static_cast<uintptr_t>(fd), filter, EV_ADD | EV_ONESHOT, fflags, 0, this);
   }
+
+  // Cancelling removes the event from the context and resumes the awaiting coroutine with ECANCELED.
+  event(ssh::context& context, int fd, short filter, ssh::cancellation_token token) noexcept : event(context.handle().value(), fd, filter) {
+    owner_ = &context;
+    token_ = std::move(token);
+  }
 #endif
 
   event(event&& other) = delete;
@@ -50,48 +74,85 @@ public:
   event(const event& other) = delete;
   event& operator=(const event& other) = delete;
 
+#if SSH_OS_WIN32
   constexpr bool await_ready() noexcept {
     return false;
   }
 
   void await_suspend(handle_type handle) noexcept {
-    handle_ = handle;
-#if SSH_OS_LINUX
-    if (::epoll_ctl(context_, EPOLL_CTL_ADD, fd_, static_cast<ssh::event_base*>(this)) < 0) {
-      error_ = errno;
-      handle_.resume();
-    }
-#elif SSH_OS_FREEBSD
-    if (::kevent(context_, static_cast<ssh::event_base*>(this), 1, nullptr, 0, nullptr) < 0) {
-      error_ = errno;
-      handle_.resume();
-    }
-#endif
+    work_.handle = handle;
+    work_.owner = ssh::context::current();
   }
 
-#if SSH_OS_WIN32
   constexpr DWORD await_resume() noexcept {
     return size_;
   }
 #else
-  constexpr int await_resume() noexcept {
+  bool await_ready() noexcept {
+    if (token_.is_cancellation_requested()) {
+      error_ = ECANCELED;
+      return true;
+    }
+    return false;
+  }
+
+  bool await_suspend(handle_type handle) noexcept {
+    work_.handle = handle;
+    work_.owner = ssh::context::current();
+    state_.store(adding, std::memory_order_relaxed);
+    if (owner_ && !start(token_)) {
+      state_.store(idle, std::memory_order_relaxed);
+      error_ = ECANCELED;
+      return false;
+    }
+#if SSH_OS_LINUX
+    const auto rv = ::epoll_ctl(context_, EPOLL_CTL_ADD, fd_, static_cast<ssh::event_base*>(this));
+#elif SSH_OS_FREEBSD
+    const auto rv = ::kevent(context_, static_cast<ssh::event_base*>(this), 1, nullptr, 0, nullptr);
+#endif
+    if (rv < 0) {
+      error_ = errno;
+      state_.store(idle, std::memory_order_release);
+      return false;
+    }
+    // The event may complete on another worker right away. The frame must not be accessed in that case.
+    auto state = adding;
+    if (state_.compare_exchange_strong(state, waiting, std::memory_order_acq_rel, std::memory_order_acquire) || state == idle) {
+      return true;
+    }
+    // Cancelled while the event was added.
+    state_.store(idle, std::memory_order_relaxed);
+    remove();
+    return true;
+  }
+
+  int await_resume() noexcept {
+    reset();
     return error_;
   }
 #endif
 
+  // Completes the event and returns the run queue entry of the awaiting coroutine.
 #if SSH_OS_WIN32
-  void resume(DWORD size) noexcept {
+  ssh::context::work* complete(DWORD size) noexcept {
     size_ = size;
-    handle_.resume();
+    return &work_;
   }
 #else
-  void resume() noexcept {
+  ssh::context::work* complete() noexcept {
+    auto state = state_.load(std::memory_order_acquire);
+    do {
+      // A cancelled event resumes the coroutine on its own.
+      if (state != adding && state != waiting) {
+        return nullptr;
+      }
+    } while (!state_.compare_exchange_weak(state, idle, std::memory_order_acq_rel, std::memory_order_acquire));
 #if SSH_OS_LINUX
-    if (const auto ev = ::epoll_ctl(context_, EPOLL_CTL_DEL, fd_, static_cast<ssh::event_base*>(this)) < 0) {
+    if (::epoll_ctl(context_, EPOLL_CTL_DEL, fd_, static_cast<ssh::event_base*>(this)) < 0) {
       error_ = errno;
     }
 #endif
-    handle_.resume();
+    return &work_;
   }
 #endif
 
@@ -104,16 +165,298 @@ public:
   }
 
 private:
-  handle_type handle_ = nullptr;
+#if !SSH_OS_WIN32
+  constexpr static std::uint32_t idle = 0;
+  constexpr static std::uint32_t adding = 1;
+  constexpr static std::uint32_t waiting = 2;
+  constexpr static std::uint32_t cancelled = 3;
+
+  static void cancel(cancellation_registration& registration) noexcept {
+    auto& event = static_cast<ssh::event&>(registration);
+    auto state = event.state_.load(std::memory_order_acquire);
+    while (state == adding || state == waiting) {
+      if (state == adding && event.state_.compare_exchange_weak(state, cancelled, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return;
+      }
+      if (state == waiting && event.state_.compare_exchange_weak(state, idle, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        event.remove();
+        return;
+      }
+    }
+  }
+
+  // Removes the cancelled event and resumes the coroutine once no worker can complete it anymore.
+  void remove() noexcept {
+#if SSH_OS_LINUX
+    ::epoll_ctl(context_, EPOLL_CTL_DEL, fd_, nullptr);
+#elif SSH_OS_FREEBSD
+    auto nev = *static_cast<ssh::event_base*>(this);
+    nev.flags = EV_DELETE;
+    ::kevent(context_, &nev, 1, nullptr, 0, nullptr);
+#endif
+    error_ = ECANCELED;
+    owner_->defer(&work_);
+  }
+#endif
+
+  ssh::context::work work_;
 #if SSH_OS_WIN32
   DWORD size_ = 0;
 #else
   int context_ = -1;
   int error_ = 0;
+  std::atomic_uint32_t state_ = idle;
+  ssh::context* owner_ = nullptr;
+  ssh::cancellation_token token_;
+#endif
+#if SSH_OS_LINUX
+  int fd_ = -1;
+#endif
+};
+
+#if !SSH_OS_WIN32
+
+// Persistent edge-triggered registration of a file descriptor.
+// The descriptor is added to the context once and stays registered until the registration is destroyed.
+// The io_uring backend watches it with a multishot poll instead, so registrations must be destroyed with ssh::retire.
+// Readiness is cached per direction, so awaiting a direction that is already ready does not suspend.
+// After an operation fails with EAGAIN, the direction must be cleared before it is awaited again.
+class registration final {
+public:
+  using handle_type = std::experimental::coroutine_handle<>;
+
+  // Lowest bit of the user data that tells registrations apart from one-shot events.
+  constexpr static std::uintptr_t tag = 1;
+
+  class direction {
+  public:
+    bool ready() const noexcept {
+      return state_.load(std::memory_order_acquire) & ready_flag;
+    }
+
+    bool suspend(handle_type handle) noexcept {
+      work_.handle = handle;
+      work_.owner = ssh::context::current();
+      waiter_.store(&work_, std::memory_order_seq_cst);
+      if ((state_.load(std::memory_order_seq_cst) & ready_flag) || cancelled_.load(std::memory_order_seq_cst)) {
+        return waiter_.exchange(nullptr, std::memory_order_acq_rel) == nullptr;
+      }
+      return true;
+    }
+
+    // Removes the waiter and returns its run queue entry. A waiter that suspends later does not suspend.
+    ssh::context::work* cancel() noexcept {
+      cancelled_.store(true, std::memory_order_seq_cst);
+      return waiter_.exchange(nullptr, std::memory_order_seq_cst);
+    }
+
+    void uncancel() noexcept {
+      cancelled_.store(false, std::memory_order_relaxed);
+    }
+
+    void observe() noexcept {
+      observed_ = state_.load(std::memory_order_acquire);
+    }
+
+    // Clears the cached readiness unless a new edge was reported since the last observation.
+    void clear() noexcept {
+      auto state = observed_;
+      state_.compare_exchange_strong(state, observed_ & ~ready_flag, std::memory_order_relaxed, std::memory_order_relaxed);
+    }
+
+    ssh::context::work* notify() noexcept {
+      auto state = state_.load(std::memory_order_relaxed);
+      while (!state_.compare_exchange_weak(state, (state + sequence_increment) | ready_flag, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      }
+      return waiter_.exchange(nullptr, std::memory_order_seq_cst);
+    }
+
+  private:
+    constexpr static std::uint32_t ready_flag = 1;
+    constexpr static std::uint32_t sequence_increment = 2;
+
+    std::atomic_uint32_t state_ = 0;
+    std::atomic<ssh::context::work*> waiter_ = nullptr;
+    std::atomic_bool cancelled_ = false;
+    ssh::context::work work_;
+    std::uint32_t observed_ = 0;
+  };
+
+  // Cancelling removes the waiter and resumes it with ECANCELED. The descriptor stays registered.
+  class operation : private ssh::cancellation_registration {
+  public:
+    operation(ssh::context& context, direction& direction, ssh::cancellation_token token) noexcept :
+      cancellation_registration(cancel), context_(context), direction_(direction), token_(std::move(token)) {
+    }
+
+    bool await_ready() const noexcept {
+      return direction_.ready() || token_.is_cancellation_requested();
+    }
+
+    bool await_suspend(handle_type handle) noexcept {
+      // The callback is registered first, because the frame must not be accessed after the waiter was published.
+      if (!start(token_)) {
+        return false;
+      }
+      return direction_.suspend(handle);
+    }
+
+    // Returns ECANCELED when cancellation of the token was requested.
+    std::error_code await_resume() noexcept {
+      reset();
+      direction_.uncancel();
+      direction_.observe();
+      if (token_.is_cancellation_requested()) {
+        return std::error_code(ECANCELED, std::system_category());
+      }
+      return {};
+    }
+
+    void clear() noexcept {
+      direction_.clear();
+    }
+
+  private:
+    static void cancel(cancellation_registration& registration) noexcept {
+      auto& operation = static_cast<registration::operation&>(registration);
+      if (const auto work = operation.direction_.cancel()) {
+        operation.context_.post(work);
+      }
+    }
+
+    ssh::context& context_;
+    direction& direction_;
+    ssh::cancellation_token token_;
+  };
+
+  registration(ssh::context& context, int fd) : context_(context), fd_(fd) {
+    const auto data = reinterpret_cast<std::uintptr_t>(this) | tag;
+#if SSH_OS_LINUX
+    if (const auto uring = context_.uring(); uring && uring->add(*this)) {
+      uring_ = uring;
+      registered_ = true;
+      return;
+    }
+    epoll_event nev = {};
+    nev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    nev.data.u64 = data;
+    if (::epoll_ctl(context_.handle().value(), EPOLL_CTL_ADD, fd_, &nev) < 0) {
+      throw_error(errno, "epoll_ctl");
+    }
+#elif SSH_OS_FREEBSD
+    struct kevent nev[2];
+    EV_SET(&nev[0], static_cast<uintptr_t>(fd_), EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, reinterpret_cast<void*>(data));
+    EV_SET(&nev[1], static_cast<uintptr_t>(fd_), EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, reinterpret_cast<void*>(data));
+    if (::kevent(context_.handle().value(), nev, 2, nullptr, 0, nullptr) < 0) {
+      throw_error(errno, "kevent");
+    }
 #endif
+    registered_ = true;
+  }
+
+  registration(registration&& other) = delete;
+  registration& operator=(registration&& other) = delete;
+
+  registration(const registration& other) = delete;
+  registration& operator=(const registration& other) = delete;
+
+  ~registration() {
+    [[maybe_unused]] const auto owned = remove();
+    assert(owned);
+  }
+
+  // Stops reporting events for the descriptor. Events that a worker already received still reference the registration.
+  // Returns false when the io_uring backend took ownership of the registration and retires it on its own.
+  bool remove() noexcept {
+    if (!registered_) {
+      return true;
+    }
+    registered_ = false;
 #if SSH_OS_LINUX
+    if (uring_) {
+      uring_->remove(*this);
+      return false;
+    }
+    ::epoll_ctl(context_.handle().value(), EPOLL_CTL_DEL, fd_, nullptr);
+#elif SSH_OS_FREEBSD
+    struct kevent nev[2];
+    EV_SET(&nev[0], static_cast<uintptr_t>(fd_), EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    EV_SET(&nev[1], static_cast<uintptr_t>(fd_), EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+    ::kevent(context_.handle().value(), nev, 2, nullptr, 0, nullptr);
+#endif
+    return true;
+  }
+
+  operation recv(ssh::cancellation_token token = {}) noexcept {
+    return operation{ context_, recv_, std::move(token) };
+  }
+
+  operation send(ssh::cancellation_token token = {}) noexcept {
+    return operation{ context_, send_, std::move(token) };
+  }
+
+  // Resumes the waiters of both directions as if an edge was reported. Can be called from any thread.
+  void wake() noexcept {
+    if (const auto work = recv_.notify()) {
+      context_.post(work);
+    }
+    if (const auto work = send_.notify()) {
+      context_.post(work);
+    }
+  }
+
+  int fd() const noexcept {
+    return fd_;
+  }
+
+  // Caches the reported readiness and returns the run queue entries of the waiting reader and writer.
+#if SSH_OS_LINUX
+  std::pair<ssh::context::work*, ssh::context::work*> complete(uint32_t events) noexcept {
+    const auto recv = events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) ? recv_.notify() : nullptr;
+    const auto send = events & (EPOLLOUT | EPOLLHUP | EPOLLERR) ? send_.notify() : nullptr;
+    return { recv, send };
+  }
+#elif SSH_OS_FREEBSD
+  std::pair<ssh::context::work*, ssh::context::work*> complete(short filter) noexcept {
+    const auto recv = filter == EVFILT_READ ? recv_.notify() : nullptr;
+    const auto send = filter == EVFILT_WRITE ? send_.notify() : nullptr;
+    return { recv, send };
+  }
+#endif
+
+private:
+#if SSH_OS_LINUX
+  friend class uring;
+#endif
+
+  ssh::context& context_;
   int fd_ = -1;
+  bool registered_ = false;
+  direction recv_;
+  direction send_;
+#if SSH_OS_LINUX
+  // Multishot poll of the io_uring backend. The other members are guarded by the submission queue mutex of the ring.
+  ssh::uring* uring_ = nullptr;
+  registration* prev_ = nullptr;
+  registration* next_ = nullptr;
+  registration* queue_ = nullptr;
+  bool armed_ = false;
+  bool removed_ = false;
+  bool queued_ = false;
 #endif
 };
 
+// Removes the registration from the context and destroys it when no worker can process its events anymore.
+inline void retire(ssh::context& context, std::unique_ptr<registration> registration) {
+  // The io_uring backend retires the registration on its own once the kernel released its poll.
+  if (registration && !registration->remove()) {
+    registration.release();
+  }
+  if (registration) {
+    context.retire(registration.release());
+  }
+}
+
+#endif
+
 }  // namespace ssh
@@ -0,0 +1,157 @@
+#include <ssh/async.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+#if !SSH_OS_WIN32
+#include <cxxabi.h>
+#endif
+
+namespace ssh {
+namespace detail {
+namespace {
+
+// Background thread that writes failures of threads without a context handler to stderr.
+// Producers only push to a lock-free queue. A wakeup that races with the reporter going to
+// sleep is picked up by the next poll.
+class reporter {
+public:
+  constexpr static auto poll_interval = std::chrono::milliseconds(100);
+
+  ~reporter() {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    write(queue_.pop());
+  }
+
+  static reporter& instance() {
+    static reporter reporter;
+    return reporter;
+  }
+
+  void push(failure_node* failures) noexcept {
+    while (failures) {
+      queue_.push(std::exchange(failures, failures->next));
+    }
+    start();
+    cv_.notify_one();
+  }
+
+  // Counts a failure that could not be recorded.
+  void drop() noexcept {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    start();
+  }
+
+private:
+  // Failures are written when the process exits if the thread cannot be started.
+  void start() noexcept {
+    try {
+      std::call_once(started_, [this]() {
+        thread_ = std::thread([this]() {
+          run();
+        });
+      });
+    }
+    catch (...) {
+    }
+  }
+
+  void run() {
+    std::unique_lock lock(mutex_);
+    while (!stop_) {
+      cv_.wait_for(lock, poll_interval);
+      lock.unlock();
+      write(queue_.pop());
+      lock.lock();
+    }
+  }
+
+  void write(failure_node* failures) noexcept {
+    while (failures) {
+      std::unique_ptr<failure_node> node(std::exchange(failures, failures->next));
+      try {
+        std::fprintf(stderr, "%s\n", format(node->failure).data());
+      }
+      catch (...) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if (const auto dropped = dropped_.exchange(0, std::memory_order_relaxed)) {
+      std::fprintf(stderr, "ssh: %llu task failures could not be reported\n", static_cast<unsigned long long>(dropped));
+    }
+  }
+
+  failure_queue queue_;
+  std::atomic_uint64_t dropped_ = 0;
+  std::once_flag started_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  bool stop_ = false;
+};
+
+}  // namespace
+
+void report(const void* task) noexcept {
+  try {
+    auto node = std::make_unique<failure_node>();
+    node->failure.task = task;
+    try {
+      throw;
+    }
+    catch (const std::exception& e) {
+      node->failure.type = &typeid(e);
+      node->failure.message = e.what();
+    }
+    catch (...) {
+    }
+    if (const auto queue = current_failure_queue()) {
+      queue->push(node.release());
+    } else {
+      reporter::instance().push(node.release());
+    }
+  }
+  catch (...) {
+    reporter::instance().drop();
+  }
+}
+
+void report(failure_node* failures) noexcept {
+  reporter::instance().push(failures);
+}
+
+}  // namespace detail
+
+std::string format(const ssh::failure& failure) {
+  std::string type = "unknown exception";
+  if (failure.type) {
+    type = failure.type->name();
+#if !SSH_OS_WIN32
+    auto status = 0;
+    if (const auto name = abi::__cxa_demangle(type.data(), nullptr, nullptr, &status)) {
+      type = name;
+      std::free(name);
+    }
+#endif
+  }
+  char task[32] = {};
+  std::snprintf(task, sizeof(task), "%p", failure.task);
+  auto line = "ssh: task " + std::string(task) + " failed with " + type;
+  if (!failure.message.empty()) {
+    line += ": " + failure.message;
+  }
+  return line;
+}
+
+}  // namespace ssh
@@ -0,0 +1,169 @@
+#include <ssh/fanout.h>
+#include <ssh/channel.h>
+#include <ssh/exception.h>
+#include <ssh/session_pool.h>
+#include <libssh/libssh.h>
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace ssh {
+namespace {
+
+// Returns the libssh message of session errors, which is more specific than the category message.
+std::string message(ssh::session& session, const std::error_code& ec) {
+  if (ec.category() == ssh::session_category()) {
+    return ssh_get_error(session.handle());
+  }
+  return ec.message();
+}
+
+}  // namespace
+
+// Results shared by the generator and its pipelines. Outlives the generator when it is destroyed early.
+class fanout::state {
+public:
+  state(ssh::context& context, const fanout::options& options, std::string command) : context(context), options(options), command(std::move(command)) {
+  }
+
+  class pop_operation {
+  public:
+    explicit pop_operation(fanout::state& state) noexcept : state_(state) {
+    }
+
+    constexpr bool await_ready() const noexcept {
+      return false;
+    }
+
+    bool await_suspend(coroutine_handle<> handle) noexcept {
+      std::lock_guard lock(state_.mutex_);
+      if (!state_.results_.empty()) {
+        return false;
+      }
+      state_.waiter_ = handle;
+      return true;
+    }
+
+    fanout::result await_resume() {
+      std::lock_guard lock(state_.mutex_);
+      auto result = std::move(state_.results_.front());
+      state_.results_.pop_front();
+      return result;
+    }
+
+  private:
+    fanout::state& state_;
+  };
+
+  // Resumes when a pipeline finished.
+  pop_operation pop() noexcept {
+    return pop_operation{ *this };
+  }
+
+  void push(fanout::result result) {
+    coroutine_handle<> waiter;
+    {
+      std::lock_guard lock(mutex_);
+      results_.push_back(std::move(result));
+      waiter = std::exchange(waiter_, nullptr);
+    }
+    if (waiter) {
+      waiter.resume();
+    }
+  }
+
+  ssh::context& context;
+  const fanout::options options;
+  const std::string command;
+
+private:
+  std::mutex mutex_;
+  std::deque<fanout::result> results_;
+  coroutine_handle<> waiter_;
+};
+
+fanout::fanout(ssh::context& context) : fanout(context, options{}) {
+}
+
+fanout::fanout(ssh::context& context, options options) : context_(context), options_(std::move(options)) {
+  options_.concurrency = std::max<std::size_t>(options_.concurrency, 1);
+}
+
+ssh::async_generator<fanout::result> fanout::run(std::vector<std::string> hosts, std::string command) {
+  const auto state = std::make_shared<fanout::state>(context_, options_, std::move(command));
+  std::size_t next = 0;
+  std::size_t running = 0;
+  const auto start = [&]() {
+    while (running < options_.concurrency && next < hosts.size()) {
+      pipeline(state, std::move(hosts[next++]));
+      running++;
+    }
+  };
+  start();
+  while (running) {
+    auto result = co_await state->pop();
+    running--;
+    // Start the next pipeline before the consumer processes the result.
+    start();
+    co_yield result;
+  }
+}
+
+ssh::task fanout::pipeline(std::shared_ptr<state> state, std::string host) {
+  fanout::result result;
+  result.host = std::move(host);
+  try {
+    if (const auto pool = state->options.pool) {
+      auto lease = co_await pool->acquire({ result.host, state->options.port, state->options.identity });
+      lease->set(state->options.token);
+      try {
+        co_await execute(*state, lease.session(), result);
+      }
+      catch (...) {
+        // A session that was cancelled in the middle of a command cannot be reused.
+        if (state->options.token.is_cancellation_requested()) {
+          lease.discard();
+        }
+        throw;
+      }
+      lease->set({});
+    } else {
+      ssh::session session(state->context);
+      session.set(state->options.token);
+      if (const auto connected = co_await session.connect(ssh::noerror, result.host, state->options.port); !connected) {
+        result.error = message(session, connected.error());
+      } else if (const auto status = co_await session.authenticate(ssh::noerror, state->options.identity); !status) {
+        result.error = message(session, status.error());
+      } else if (*status != ssh::auth_result::success) {
+        result.error = "Authentication failed";
+      } else {
+        co_await execute(*state, session, result);
+      }
+    }
+  }
+  catch (const std::exception& e) {
+    result.error = e.what();
+  }
+  catch (...) {
+    result.error = "Unknown error";
+  }
+  state->push(std::move(result));
+}
+
+ssh::async<void> fanout::execute(const state& state, ssh::session& session, result& result) {
+  ssh::channel channel(session);
+  co_await channel.exec(state.command);
+  std::array<char, 4096> buffer;
+  auto is_stderr = false;
+  // Both streams are read as data arrives and output beyond the limit is discarded, so that the
+  // channel window keeps moving without libssh buffering the other stream.
+  while (const auto size = co_await channel.read_any(buffer.data(), buffer.size(), is_stderr)) {
+    auto& output = is_stderr ? result.error_output : result.output;
+    output.append(buffer.data(), std::min(size, state.options.output - std::min(output.size(), state.options.output)));
+  }
+  result.exit_status = co_await channel.close();
+}
+
+}  // namespace ssh
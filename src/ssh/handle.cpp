@@ -1,4 +1,4 @@
-#include <ice/handle.h>
+#include <ssh/handle.h>
 #include <cerrno>
 
 #if SSH_OS_WIN32
@@ -7,7 +7,7 @@
 #include <unistd.h>
 #endif
 
-namespace ice {
+namespace ssh {
 
 void handle::default_close(ssh::handle& handle) noexcept {
 #if SSH_OS_WIN32
@@ -22,4 +22,4 @@ void handle::default_close(ssh::handle& handle) noexcept {
   handle.release();
 }
 
-}  // namespace ice
+}  // namespace ssh
@@ -0,0 +1,304 @@
+#include <ssh/log.h>
+#include <ssh/config.h>
+#include <ssh/exception.h>
+#include <libssh/libssh.h>
+#include <libssh/callbacks.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace ssh::log {
+namespace {
+
+using clock = std::chrono::system_clock;
+
+struct record {
+  clock::time_point time;
+  int priority = 0;
+  std::uint32_t size = 0;
+  std::array<char, 240> text;
+};
+
+// Single producer, single consumer ring of a logging thread. Rings are reused by later threads
+// and deleted when the process exits.
+struct ring {
+  constexpr static std::size_t capacity = 1024;
+
+  explicit ring(std::size_t id) noexcept : id(id) {
+  }
+
+  // Called by the thread that owns the ring.
+  bool push(int priority, const char* buffer) noexcept {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    const auto size = tail - head_.load(std::memory_order_acquire);
+    if (size == capacity) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    auto& entry = records_[tail % capacity];
+    entry.time = clock::now();
+    entry.priority = priority;
+    entry.size = buffer ? static_cast<std::uint32_t>(strnlen(buffer, entry.text.size())) : 0;
+    if (entry.size) {
+      std::memcpy(entry.text.data(), buffer, entry.size);
+    }
+    tail_.store(tail + 1, std::memory_order_release);
+    // Wakes up the writer early when the ring fills up faster than it is polled.
+    return size + 1 == capacity / 2;
+  }
+
+  // Called by the writer with the sink mutex locked.
+  template <typename Callable>
+  void drain(Callable&& callable) {
+    auto head = head_.load(std::memory_order_relaxed);
+    const auto tail = tail_.load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      callable(records_[head % capacity]);
+    }
+    head_.store(head, std::memory_order_release);
+  }
+
+  const std::size_t id;
+  std::atomic_uint64_t dropped = 0;
+  std::atomic_bool owned = true;
+  ring* next = nullptr;
+
+private:
+  alignas(64) std::atomic_size_t head_ = 0;
+  alignas(64) std::atomic_size_t tail_ = 0;
+  std::array<record, capacity> records_;
+};
+
+const char* level(int priority) noexcept {
+  switch (priority) {
+  case SSH_LOG_WARNING: return "warning";
+  case SSH_LOG_PROTOCOL: return "protocol";
+  case SSH_LOG_PACKET: return "packet";
+  case SSH_LOG_FUNCTIONS: return "functions";
+  }
+  return "log";
+}
+
+// Background thread that writes the rings of all threads to a file.
+class sink {
+public:
+  constexpr static auto poll_interval = std::chrono::milliseconds(10);
+
+  ~sink() {
+    if (thread_.joinable()) {
+      ssh_set_log_callback(nullptr);
+      {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_one();
+      thread_.join();
+    }
+    std::lock_guard lock(mutex_);
+    write();
+    close();
+    for (auto ring = rings_.load(std::memory_order_acquire); ring;) {
+      delete std::exchange(ring, ring->next);
+    }
+  }
+
+  static sink& instance() {
+    static sink sink;
+    return sink;
+  }
+
+  // Raises the level that is applied to every thread. A lower level only affects the calling thread.
+  void install(int level) {
+    if (level > SSH_LOG_NOLOG) {
+      std::call_once(installed_, [this]() {
+        thread_ = std::thread([this]() {
+          run();
+        });
+      });
+    }
+    auto current = level_.load(std::memory_order_relaxed);
+    while (current < level && !level_.compare_exchange_weak(current, level, std::memory_order_relaxed)) {
+    }
+    // Setting the session verbosity also changed the level of the calling thread.
+    if (const auto level = level_.load(std::memory_order_relaxed); level > SSH_LOG_NOLOG) {
+      apply(level);
+    }
+  }
+
+  // Libssh keeps the callback and the level per thread.
+  void attach() noexcept {
+    if (const auto level = level_.load(std::memory_order_relaxed); level != applied_) {
+      apply(level);
+    }
+  }
+
+  void open(const std::string& filename) {
+    const auto file = std::fopen(filename.data(), "ab");
+    if (!file) {
+      throw_error(errno, "fopen");
+    }
+    std::lock_guard lock(mutex_);
+    write();
+    close();
+    file_ = file;
+  }
+
+  void flush() {
+    std::lock_guard lock(mutex_);
+    write();
+  }
+
+  std::uint64_t dropped() const noexcept {
+    std::uint64_t dropped = 0;
+    for (auto ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next) {
+      dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped + lost_.load(std::memory_order_relaxed);
+  }
+
+private:
+  static void apply(int level) noexcept {
+    ssh_set_log_callback(callback);
+    ssh_set_log_level(level);
+    applied_ = level;
+  }
+
+  // Releases the ring of a thread when the thread exits.
+  struct owner {
+    ~owner() {
+      if (ring) {
+        ring->owned.store(false, std::memory_order_release);
+      }
+    }
+
+    ssh::log::ring* ring = nullptr;
+  };
+
+  static void callback(int priority, const char*, const char* buffer, void*) noexcept {
+    thread_local owner owner;
+    auto& sink = instance();
+    if (!owner.ring) {
+      owner.ring = sink.acquire();
+      if (!owner.ring) {
+        return;
+      }
+    }
+    if (owner.ring->push(priority, buffer)) {
+      sink.cv_.notify_one();
+    }
+  }
+
+  // Takes over the ring of a thread that exited or adds a new one.
+  ring* acquire() noexcept {
+    for (auto ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next) {
+      if (!ring->owned.exchange(true, std::memory_order_acquire)) {
+        return ring;
+      }
+    }
+    const auto ring = new (std::nothrow) ssh::log::ring(count_.fetch_add(1, std::memory_order_relaxed));
+    if (!ring) {
+      lost_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    auto head = rings_.load(std::memory_order_relaxed);
+    do {
+      ring->next = head;
+    } while (!rings_.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+    return ring;
+  }
+
+  void run() {
+    std::unique_lock lock(mutex_);
+    while (!stop_) {
+      cv_.wait_for(lock, poll_interval);
+      write();
+    }
+  }
+
+  // Called with the mutex locked.
+  void write() noexcept {
+    const auto file = file_ ? file_ : stderr;
+    auto written = false;
+    for (auto ring = rings_.load(std::memory_order_acquire); ring; ring = ring->next) {
+      ring->drain([&](const record& record) {
+        const auto time = clock::to_time_t(record.time);
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(record.time.time_since_epoch()).count() % 1000000;
+        std::tm tm = {};
+#if SSH_OS_WIN32
+        gmtime_s(&tm, &time);
+#else
+        gmtime_r(&time, &tm);
+#endif
+        char date[32] = {};
+        std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        std::fprintf(file, "%s.%06d %zu %s: %.*s\n", date, static_cast<int>(us), ring->id, level(record.priority), static_cast<int>(record.size),
+                     record.text.data());
+        written = true;
+      });
+    }
+    const auto dropped = this->dropped();
+    if (dropped != reported_) {
+      std::fprintf(file, "ssh: %llu log records dropped\n", static_cast<unsigned long long>(dropped - reported_));
+      reported_ = dropped;
+      written = true;
+    }
+    if (written) {
+      std::fflush(file);
+    }
+  }
+
+  void close() noexcept {
+    if (file_) {
+      std::fclose(std::exchange(file_, nullptr));
+    }
+  }
+
+  static thread_local int applied_;
+
+  std::atomic_int level_ = SSH_LOG_NOLOG;
+  std::atomic<ring*> rings_ = nullptr;
+  std::atomic_size_t count_ = 0;
+  std::atomic_uint64_t lost_ = 0;
+  std::uint64_t reported_ = 0;
+  std::once_flag installed_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  std::FILE* file_ = nullptr;
+  bool stop_ = false;
+};
+
+thread_local int sink::applied_ = SSH_LOG_NOLOG;
+
+}  // namespace
+
+void install(int level) {
+  sink::instance().install(level);
+}
+
+void attach() noexcept {
+  sink::instance().attach();
+}
+
+void open(const std::string& filename) {
+  sink::instance().open(filename);
+}
+
+void flush() {
+  sink::instance().flush();
+}
+
+std::uint64_t dropped() noexcept {
+  return sink::instance().dropped();
+}
+
+}  // namespace ssh::log
@@ -0,0 +1,500 @@
+#include <ssh/net.h>
+#include <ssh/event.h>
+#include <ssh/exception.h>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+#if !SSH_OS_WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <climits>
+
+namespace ssh::net {
+namespace {
+
+static_assert(sizeof(ssh::net::buffer) == sizeof(iovec));
+static_assert(offsetof(ssh::net::buffer, data) == offsetof(iovec, iov_base));
+static_assert(offsetof(ssh::net::buffer, size) == offsetof(iovec, iov_len));
+static_assert(sizeof(sockaddr_storage) <= 128);
+
+constexpr std::size_t iov_max = IOV_MAX < 1024 ? IOV_MAX : 1024;
+
+// Pending connections do not report a new edge, so accept retries after this delay when it runs out of resources.
+constexpr auto accept_retry_delay = std::chrono::milliseconds(10);
+
+bool would_block(int error) noexcept {
+  return error == EAGAIN || error == EWOULDBLOCK;
+}
+
+// Errors of a connection that was aborted before it could be accepted. The next connection can still be accepted.
+// Linux also reports pending network errors of the new connection.
+bool aborted(int error) noexcept {
+  switch (error) {
+  case ECONNABORTED:
+  case EPROTO:
+#if SSH_OS_LINUX
+  case ENETDOWN:
+  case ENOPROTOOPT:
+  case EHOSTDOWN:
+  case ENONET:
+  case EHOSTUNREACH:
+  case EOPNOTSUPP:
+  case ENETUNREACH:
+#endif
+    return true;
+  }
+  return false;
+}
+
+// Errors that go away when other connections are closed.
+bool exhausted(int error) noexcept {
+  return error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+}
+
+// Throws the error or returns it as the result of a non-throwing operation.
+template <typename Result>
+Result fail(int error, const char* message) {
+  if constexpr (ssh::is_result_v<Result>) {
+    return Result{ std::error_code(error, std::system_category()) };
+  } else {
+    throw ssh::system_error(std::error_code(error, std::system_category()), message);
+  }
+}
+
+std::error_code socket_error(int fd) noexcept {
+  int error = 0;
+  socklen_t size = sizeof(error);
+  if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0) {
+    error = errno;
+  }
+  return { error, std::system_category() };
+}
+
+}  // namespace
+
+void endpoint::create(const std::string& host, std::uint16_t port) {
+  if (!create(ssh::noerror, host, port)) {
+    throw ssh::domain_error("Invalid address: " + host);
+  }
+}
+
+bool endpoint::create(ssh::noerror_tag, const std::string& host, std::uint16_t port) noexcept {
+  storage_ = {};
+  if (const auto addr = reinterpret_cast<sockaddr_in*>(storage_.data()); ::inet_pton(AF_INET, host.c_str(), &addr->sin_addr) == 1) {
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    size_ = sizeof(sockaddr_in);
+    return true;
+  }
+  if (const auto addr = reinterpret_cast<sockaddr_in6*>(storage_.data()); ::inet_pton(AF_INET6, host.c_str(), &addr->sin6_addr) == 1) {
+    addr->sin6_family = AF_INET6;
+    addr->sin6_port = htons(port);
+    size_ = sizeof(sockaddr_in6);
+    return true;
+  }
+  size_ = 0;
+  return false;
+}
+
+int endpoint::family() const noexcept {
+  return size_ ? data()->sa_family : AF_UNSPEC;
+}
+
+std::string endpoint::host() const {
+  char buffer[INET6_ADDRSTRLEN] = {};
+  switch (family()) {
+  case AF_INET: ::inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(data())->sin_addr, buffer, sizeof(buffer)); break;
+  case AF_INET6: ::inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(data())->sin6_addr, buffer, sizeof(buffer)); break;
+  }
+  return buffer;
+}
+
+std::uint16_t endpoint::port() const noexcept {
+  switch (family()) {
+  case AF_INET: return ntohs(reinterpret_cast<const sockaddr_in*>(data())->sin_port);
+  case AF_INET6: return ntohs(reinterpret_cast<const sockaddr_in6*>(data())->sin6_port);
+  }
+  return 0;
+}
+
+namespace option {
+
+value nodelay(bool enable) noexcept {
+  return { IPPROTO_TCP, TCP_NODELAY, enable ? 1 : 0 };
+}
+
+value reuseaddr(bool enable) noexcept {
+  return { SOL_SOCKET, SO_REUSEADDR, enable ? 1 : 0 };
+}
+
+value reuseport(bool enable) noexcept {
+#ifdef SO_REUSEPORT_LB
+  // Only the load balancing variant distributes connections between the listeners on FreeBSD.
+  return { SOL_SOCKET, SO_REUSEPORT_LB, enable ? 1 : 0 };
+#else
+  return { SOL_SOCKET, SO_REUSEPORT, enable ? 1 : 0 };
+#endif
+}
+
+value keepalive(bool enable) noexcept {
+  return { SOL_SOCKET, SO_KEEPALIVE, enable ? 1 : 0 };
+}
+
+value recv_buffer_size(int size) noexcept {
+  return { SOL_SOCKET, SO_RCVBUF, size };
+}
+
+value send_buffer_size(int size) noexcept {
+  return { SOL_SOCKET, SO_SNDBUF, size };
+}
+
+}  // namespace option
+
+namespace tcp {
+
+socket::socket(ssh::context& context) noexcept : context_(&context) {
+}
+
+socket::socket(ssh::context& context, ssh::handle handle) noexcept : context_(&context), handle_(std::move(handle)) {
+}
+
+socket::socket(socket&& other) noexcept :
+  context_(other.context_), handle_(std::move(other.handle_)), registration_(std::move(other.registration_)) {
+}
+
+socket& socket::operator=(socket&& other) noexcept {
+  if (this != std::addressof(other)) {
+    close();
+    registration_ = std::move(other.registration_);
+    handle_ = std::move(other.handle_);
+    context_ = other.context_;
+  }
+  return *this;
+}
+
+socket::~socket() {
+  close();
+}
+
+void socket::create(int family) {
+  create<void>(family);
+}
+
+void socket::set(const ssh::net::option::value& option) {
+  if (::setsockopt(handle_.value(), option.level, option.name, &option.data, sizeof(option.data)) < 0) {
+    throw_error(errno, "setsockopt");
+  }
+}
+
+void socket::bind(const ssh::net::endpoint& endpoint) {
+  if (::bind(handle_.value(), endpoint.data(), endpoint.size()) < 0) {
+    throw_error(errno, "bind");
+  }
+}
+
+void socket::listen(int backlog) {
+  if (::listen(handle_.value(), backlog < 0 ? SOMAXCONN : backlog) < 0) {
+    throw_error(errno, "listen");
+  }
+}
+
+template <typename Result>
+Result socket::create(int family) {
+  close();
+  handle_.reset(::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+  if (!handle_) {
+    return fail<Result>(errno, "socket");
+  }
+  return Result();
+}
+
+template <typename Result>
+ssh::async<Result> socket::connect(ssh::net::endpoint endpoint, ssh::cancellation_token token) {
+  if (!handle_) {
+    if constexpr (ssh::is_result_v<Result>) {
+      if (auto result = create<Result>(endpoint.family()); !result) {
+        co_return result;
+      }
+    } else {
+      create<Result>(endpoint.family());
+    }
+  }
+  if (::connect(handle_.value(), endpoint.data(), endpoint.size()) == 0) {
+    co_return Result();
+  }
+  // A connect that was interrupted by a signal also completes asynchronously.
+  if (errno != EINPROGRESS && errno != EINTR) {
+    co_return fail<Result>(errno, "connect");
+  }
+  // The registration is created after the connect call, because an unconnected socket reports a hangup.
+  if (const auto ec = co_await registration().send(std::move(token))) {
+    co_return fail<Result>(ec.value(), "connect");
+  }
+  if (const auto ec = socket_error(handle_.value())) {
+    co_return fail<Result>(ec.value(), "connect");
+  }
+  co_return Result();
+}
+
+template <typename Result>
+ssh::async<Result> socket::await(bool send, ssh::cancellation_token token) {
+  auto operation = send ? registration().send(std::move(token)) : registration().recv(std::move(token));
+  if (const auto ec = co_await operation) {
+    co_return fail<Result>(ec.value(), send ? "send" : "recv");
+  }
+  co_return Result{ socket_error(handle_.value()) };
+}
+
+template <typename Result>
+ssh::async<Result> socket::recv(char* data, std::size_t size, ssh::cancellation_token token) {
+  while (true) {
+    if (const auto rv = ::recv(handle_.value(), data, size, 0); rv >= 0) {
+      co_return std::string_view{ data, static_cast<std::size_t>(rv) };
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (!would_block(errno)) {
+      co_return fail<Result>(errno, "recv");
+    }
+    auto operation = registration().recv(token);
+    operation.clear();
+    if (const auto ec = co_await operation) {
+      co_return fail<Result>(ec.value(), "recv");
+    }
+  }
+}
+
+template <typename Result>
+ssh::async<Result> socket::recv(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token) {
+  const auto iov = reinterpret_cast<const iovec*>(buffers);
+  const auto size = static_cast<int>(std::min(count, iov_max));
+  while (true) {
+    if (const auto rv = ::readv(handle_.value(), iov, size); rv >= 0) {
+      co_return static_cast<std::size_t>(rv);
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (!would_block(errno)) {
+      co_return fail<Result>(errno, "readv");
+    }
+    auto operation = registration().recv(token);
+    operation.clear();
+    if (const auto ec = co_await operation) {
+      co_return fail<Result>(ec.value(), "readv");
+    }
+  }
+}
+
+template <typename Result>
+ssh::async<Result> socket::send(std::string_view data, ssh::cancellation_token token) {
+  std::size_t sent = 0;
+  while (sent < data.size()) {
+    if (const auto rv = ::send(handle_.value(), data.data() + sent, data.size() - sent, MSG_NOSIGNAL); rv >= 0) {
+      sent += static_cast<std::size_t>(rv);
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (!would_block(errno)) {
+      co_return fail<Result>(errno, "send");
+    }
+    auto operation = registration().send(token);
+    operation.clear();
+    if (const auto ec = co_await operation) {
+      co_return fail<Result>(ec.value(), "send");
+    }
+  }
+  co_return sent;
+}
+
+template <typename Result>
+ssh::async<Result> socket::send(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token) {
+  // Buffers are copied in batches, because partially sent entries are adjusted in place.
+  std::array<iovec, 64> iov;
+  std::size_t sent = 0;
+  while (count > 0) {
+    const auto size = std::min(count, iov.size());
+    std::memcpy(iov.data(), buffers, size * sizeof(iovec));
+    std::size_t index = 0;
+    while (true) {
+      while (index < size && iov[index].iov_len == 0) {
+        index++;
+      }
+      if (index == size) {
+        break;
+      }
+      msghdr msg = {};
+      msg.msg_iov = iov.data() + index;
+      msg.msg_iovlen = size - index;
+      const auto rv = ::sendmsg(handle_.value(), &msg, MSG_NOSIGNAL);
+      if (rv < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (!would_block(errno)) {
+          co_return fail<Result>(errno, "sendmsg");
+        }
+        auto operation = registration().send(token);
+        operation.clear();
+        if (const auto ec = co_await operation) {
+          co_return fail<Result>(ec.value(), "sendmsg");
+        }
+        continue;
+      }
+      sent += static_cast<std::size_t>(rv);
+      for (auto remaining = static_cast<std::size_t>(rv); remaining > 0; index++) {
+        if (remaining < iov[index].iov_len) {
+          iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + remaining;
+          iov[index].iov_len -= remaining;
+          break;
+        }
+        remaining -= iov[index].iov_len;
+      }
+    }
+    buffers += size;
+    count -= size;
+  }
+  co_return sent;
+}
+
+ssh::async<void> socket::connect(ssh::net::endpoint endpoint, ssh::cancellation_token token) {
+  return connect<void>(std::move(endpoint), std::move(token));
+}
+
+ssh::async<ssh::result<void>> socket::connect(ssh::noerror_tag, ssh::net::endpoint endpoint, ssh::cancellation_token token) {
+  return connect<ssh::result<void>>(std::move(endpoint), std::move(token));
+}
+
+ssh::async_generator<socket> socket::accept(ssh::cancellation_token token) {
+  while (true) {
+    ssh::handle client(::accept4(handle_.value(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+    if (client) {
+      co_yield socket{ *context_, std::move(client) };
+      continue;
+    }
+    if (errno == EINTR || aborted(errno)) {
+      continue;
+    }
+    if (exhausted(errno)) {
+      co_await context_->sleep(accept_retry_delay);
+      continue;
+    }
+    if (!would_block(errno)) {
+      throw_error(errno, "accept4");
+    }
+    // The backlog is drained, wait for the next edge.
+    auto operation = registration().recv(token);
+    operation.clear();
+    if (const auto ec = co_await operation) {
+      throw_error(ec.value(), "accept4");
+    }
+  }
+}
+
+ssh::async<std::error_code> socket::await_recv(ssh::cancellation_token token) {
+  return await<std::error_code>(false, std::move(token));
+}
+
+ssh::async<std::error_code> socket::await_send(ssh::cancellation_token token) {
+  return await<std::error_code>(true, std::move(token));
+}
+
+ssh::async<ssh::result<void>> socket::await_recv(ssh::noerror_tag, ssh::cancellation_token token) {
+  return await<ssh::result<void>>(false, std::move(token));
+}
+
+ssh::async<ssh::result<void>> socket::await_send(ssh::noerror_tag, ssh::cancellation_token token) {
+  return await<ssh::result<void>>(true, std::move(token));
+}
+
+ssh::async<std::string_view> socket::recv(char* data, std::size_t size, ssh::cancellation_token token) {
+  return recv<std::string_view>(data, size, std::move(token));
+}
+
+ssh::async<std::size_t> socket::recv(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token) {
+  return recv<std::size_t>(buffers, count, std::move(token));
+}
+
+ssh::async<ssh::result<std::string_view>> socket::recv(ssh::noerror_tag, char* data, std::size_t size, ssh::cancellation_token token) {
+  return recv<ssh::result<std::string_view>>(data, size, std::move(token));
+}
+
+ssh::async<ssh::result<std::size_t>> socket::recv(ssh::noerror_tag, const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token) {
+  return recv<ssh::result<std::size_t>>(buffers, count, std::move(token));
+}
+
+ssh::async<std::size_t> socket::send(std::string_view data, ssh::cancellation_token token) {
+  return send<std::size_t>(data, std::move(token));
+}
+
+ssh::async<std::size_t> socket::send(const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token) {
+  return send<std::size_t>(buffers, count, std::move(token));
+}
+
+ssh::async<ssh::result<std::size_t>> socket::send(ssh::noerror_tag, std::string_view data, ssh::cancellation_token token) {
+  return send<ssh::result<std::size_t>>(data, std::move(token));
+}
+
+ssh::async<ssh::result<std::size_t>> socket::send(ssh::noerror_tag, const ssh::net::buffer* buffers, std::size_t count, ssh::cancellation_token token) {
+  return send<ssh::result<std::size_t>>(buffers, count, std::move(token));
+}
+
+void socket::shutdown() {
+  if (::shutdown(handle_.value(), SHUT_WR) < 0) {
+    throw_error(errno, "shutdown");
+  }
+}
+
+void socket::close() noexcept {
+  if (registration_) {
+    ssh::retire(*context_, std::move(registration_));
+  }
+  handle_.close();
+}
+
+ssh::handle socket::release() noexcept {
+  if (registration_) {
+    ssh::retire(*context_, std::move(registration_));
+  }
+  return std::move(handle_);
+}
+
+ssh::net::endpoint socket::local() const {
+  ssh::net::endpoint endpoint;
+  auto size = static_cast<socklen_t>(endpoint.capacity());
+  if (::getsockname(handle_.value(), endpoint.data(), &size) < 0) {
+    throw_error(errno, "getsockname");
+  }
+  endpoint.resize(static_cast<std::uint32_t>(size));
+  return endpoint;
+}
+
+ssh::net::endpoint socket::remote() const {
+  ssh::net::endpoint endpoint;
+  auto size = static_cast<socklen_t>(endpoint.capacity());
+  if (::getpeername(handle_.value(), endpoint.data(), &size) < 0) {
+    throw_error(errno, "getpeername");
+  }
+  endpoint.resize(static_cast<std::uint32_t>(size));
+  return endpoint;
+}
+
+ssh::registration& socket::registration() {
+  if (!registration_) {
+    registration_ = std::make_unique<ssh::registration>(*context_, handle_.value());
+  }
+  return *registration_;
+}
+
+}  // namespace tcp
+}  // namespace ssh::net
+
+#endif
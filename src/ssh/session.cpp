@@ -1,16 +1,107 @@
-#include <ice/ssh/session.h>
+#include <ssh/session.h>
+#include <ssh/channel.h>
+#include <ssh/event.h>
+#include <ssh/exception.h>
+#include <ssh/log.h>
+#include <ssh/net.h>
 #include <libssh/libssh.h>
+#include <utility>
+#include <cerrno>
 
-namespace ssh::ssh {
+namespace ssh {
+namespace {
 
-session::session(ssh::context& context) : handle_(::ssh_new(), ::ssh_free), socket_(context) {
+const char* name(const std::string& user) noexcept {
+  return user.empty() ? nullptr : user.c_str();
+}
+
+// Throws the libssh error or returns it as the result of a non-throwing operation.
+template <typename Result>
+Result fail(ssh_session session) {
+  if constexpr (ssh::is_result_v<Result>) {
+    // Some libssh calls fail without setting an error code.
+    const auto code = ssh_get_error_code(session);
+    return Result{ std::error_code(code != SSH_NO_ERROR ? code : SSH_FATAL, ssh::session_category()) };
+  } else {
+    throw ssh::domain_error(ssh_get_error(session));
+  }
+}
+
+// Throws ECANCELED or returns it as the result of a non-throwing operation.
+template <typename Result>
+Result cancelled() {
+  if constexpr (ssh::is_result_v<Result>) {
+    return Result{ std::error_code(ECANCELED, std::system_category()) };
+  } else {
+    throw ssh::system_error(std::error_code(ECANCELED, std::system_category()), "session");
+  }
+}
+
+// Converts an authentication return code.
+template <typename Result>
+Result status(ssh_session session, int rc) {
+  switch (rc) {
+  case SSH_AUTH_SUCCESS: return ssh::auth_result::success;
+  case SSH_AUTH_PARTIAL: return ssh::auth_result::partial;
+  case SSH_AUTH_DENIED: return ssh::auth_result::denied;
+  }
+  return fail<Result>(session);
+}
+
+// Returns true when authenticate stops trying further methods.
+bool done(ssh::auth_result status) noexcept {
+  return status == ssh::auth_result::success;
+}
+
+bool done(const ssh::result<ssh::auth_result>& status) noexcept {
+  return !status || *status == ssh::auth_result::success;
+}
+
+class session_category_impl : public std::error_category {
+public:
+  using std::error_category::error_category;
+
+  const char* name() const noexcept override {
+    return "ssh::session";
+  }
+
+  std::string message(int ev) const override {
+    switch (ev) {
+    case SSH_REQUEST_DENIED: return "request denied";
+    case SSH_FATAL: return "fatal error";
+    case SSH_EINTR: return "interrupted";
+    }
+    return "unknown error";
+  }
+};
+
+session_category_impl g_session_category;
+
+}  // namespace
+
+const std::error_category& session_category() noexcept {
+  return g_session_category;
+}
+
+session::session(ssh::context& context) : context_(&context), handle_(::ssh_new(), ::ssh_free) {
   if (!handle_) {
     throw ssh::domain_error("Could not create ssh session");
   }
-  ssh_set_blocking(handle(), 1);
-  //ssh_options_set(handle(), SSH_OPTIONS_HOST, "localhost");
-  //ssh_options_set(handle(), SSH_OPTIONS_PORT, &port);
-  throw ssh::domain_error(std::to_string(::ssh_get_fd(handle())));
+  // The IOCP backend cannot wait for socket readiness, so sessions stay blocking on Windows.
+  ssh_set_blocking(handle(), SSH_OS_WIN32 ? 1 : 0);
+}
+
+session::~session() {
+  canceller_.reset();
+  if (recv_.alive) {
+    *recv_.alive = false;
+  }
+  if (send_.alive) {
+    *send_.alive = false;
+  }
+#if !SSH_OS_WIN32
+  ssh::retire(*context_, std::move(registration_));
+#endif
 }
 
 void session::set(ssh::verbosity verbosity) {
@@ -25,13 +116,384 @@ void session::set(ssh::verbosity verbosity) {
   if (ssh_options_set(handle(), SSH_OPTIONS_LOG_VERBOSITY, &value)) {
     throw ssh::domain_error(ssh_get_error(handle()));
   }
+  ssh::log::install(value);
+}
+
+void session::set(ssh::cancellation_token token) {
+  token_ = std::move(token);
+  if (!canceller_.start(token_)) {
+    wake();
+  }
+}
+
+void session::check() const {
+  if (token_.is_cancellation_requested()) {
+    throw_error(ECANCELED, "session");
+  }
+}
+
+void session::canceller::complete(cancellation_registration& registration) noexcept {
+  static_cast<canceller&>(registration).session_.wake();
+}
+
+void session::wake() noexcept {
+#if !SSH_OS_WIN32
+  // The poll loops resume the waiting coroutines, which throw when they check the token.
+  std::lock_guard lock(registration_mutex_);
+  if (registration_) {
+    registration_->wake();
+  }
+#endif
+}
+
+template <typename Result>
+ssh::async<Result> session::connect(std::string host, std::uint16_t port) {
+#if !SSH_OS_WIN32
+  // Libssh reports every connection failure as SSH_FATAL. Numeric addresses are connected by the context instead,
+  // so that errors like ECONNREFUSED or ETIMEDOUT keep their error code.
+  if (ssh::net::endpoint endpoint; endpoint.create(ssh::noerror, host, port)) {
+    ssh::net::tcp::socket socket(*context_);
+    if constexpr (ssh::is_result_v<Result>) {
+      if (auto result = co_await socket.connect(ssh::noerror, std::move(endpoint), token_); !result) {
+        co_return result;
+      }
+    } else {
+      co_await socket.connect(std::move(endpoint), token_);
+    }
+    co_return co_await connect<Result>(std::move(socket), std::move(host));
+  }
+#endif
+  if (ssh_options_set(handle(), SSH_OPTIONS_HOST, host.c_str())) {
+    co_return fail<Result>(handle());
+  }
+  unsigned int value = port;
+  if (ssh_options_set(handle(), SSH_OPTIONS_PORT, &value)) {
+    co_return fail<Result>(handle());
+  }
+  co_return co_await handshake<Result>();
+}
+
+#if !SSH_OS_WIN32
+
+template <typename Result>
+ssh::async<Result> session::connect(ssh::net::tcp::socket socket, std::string host) {
+  if (ssh_options_set(handle(), SSH_OPTIONS_HOST, host.c_str())) {
+    co_return fail<Result>(handle());
+  }
+  unsigned int port = socket.remote().port();
+  if (ssh_options_set(handle(), SSH_OPTIONS_PORT, &port)) {
+    co_return fail<Result>(handle());
+  }
+  auto fd = socket.release();
+  socket_t value = fd.value();
+  if (ssh_options_set(handle(), SSH_OPTIONS_FD, &value)) {
+    co_return fail<Result>(handle());
+  }
+  fd.release();
+  co_return co_await handshake<Result>();
+}
+
+#endif
+
+template <typename Result>
+ssh::async<Result> session::handshake() {
+  while (true) {
+    const auto rc = ssh_connect(handle());
+    if (rc == SSH_OK) {
+      co_return Result();
+    }
+    if (rc != SSH_AGAIN) {
+      co_return fail<Result>(handle());
+    }
+    co_await wait(ssh::noerror);
+    if (token_.is_cancellation_requested()) {
+      co_return cancelled<Result>();
+    }
+  }
+}
+
+template <typename Result>
+ssh::async<Result> session::auth_password(std::string user, std::string password) {
+  while (true) {
+    const auto rc = ssh_userauth_password(handle(), name(user), password.c_str());
+    if (rc != SSH_AUTH_AGAIN) {
+      co_return status<Result>(handle(), rc);
+    }
+    co_await wait(ssh::noerror);
+    if (token_.is_cancellation_requested()) {
+      co_return cancelled<Result>();
+    }
+  }
+}
+
+template <typename Result>
+ssh::async<Result> session::auth_publickey(std::string user, std::string key, std::string passphrase) {
+  ssh_key privkey = nullptr;
+  if (ssh_pki_import_privkey_file(key.c_str(), passphrase.empty() ? nullptr : passphrase.c_str(), nullptr, nullptr, &privkey) != SSH_OK) {
+    if constexpr (ssh::is_result_v<Result>) {
+      co_return std::make_error_code(std::errc::invalid_argument);
+    } else {
+      throw ssh::domain_error("Could not import private key: " + key);
+    }
+  }
+  std::unique_ptr<ssh_key_struct, void (*)(ssh_key)> guard(privkey, ::ssh_key_free);
+  // The signature is sent right away instead of asking whether the server accepts the key first.
+  while (true) {
+    const auto rc = ssh_userauth_publickey(handle(), name(user), privkey);
+    if (rc != SSH_AUTH_AGAIN) {
+      co_return status<Result>(handle(), rc);
+    }
+    co_await wait(ssh::noerror);
+    if (token_.is_cancellation_requested()) {
+      co_return cancelled<Result>();
+    }
+  }
+}
+
+template <typename Result>
+ssh::async<Result> session::auth_agent(std::string user) {
+  while (true) {
+    const auto rc = ssh_userauth_agent(handle(), name(user));
+    if (rc != SSH_AUTH_AGAIN) {
+      co_return status<Result>(handle(), rc);
+    }
+    co_await wait(ssh::noerror);
+    if (token_.is_cancellation_requested()) {
+      co_return cancelled<Result>();
+    }
+  }
+}
+
+template <typename Result>
+ssh::async<Result> session::authenticate(ssh::identity identity) {
+  Result status = ssh::auth_result::denied;
+  if (identity.agent && allowed(SSH_AUTH_METHOD_PUBLICKEY)) {
+    status = co_await auth_agent<Result>(identity.user);
+    if (done(status)) {
+      co_return status;
+    }
+  }
+  if (!identity.key.empty() && allowed(SSH_AUTH_METHOD_PUBLICKEY)) {
+    status = co_await auth_publickey<Result>(identity.user, identity.key, identity.passphrase);
+    if (done(status)) {
+      co_return status;
+    }
+  }
+  if (!identity.password.empty() && allowed(SSH_AUTH_METHOD_PASSWORD)) {
+    status = co_await auth_password<Result>(identity.user, identity.password);
+  }
+  co_return status;
+}
+
+template <typename Result>
+ssh::async<Result> session::flush() {
+  while (true) {
+    const auto rc = ssh_blocking_flush(handle(), 0);
+    notify();
+    if (rc == SSH_OK) {
+      co_return Result();
+    }
+    if (rc != SSH_AGAIN) {
+      co_return fail<Result>(handle());
+    }
+    co_await wait(ssh::noerror);
+    if (token_.is_cancellation_requested()) {
+      co_return cancelled<Result>();
+    }
+  }
+}
+
+ssh::async<void> session::connect(std::string host, std::uint16_t port) {
+  return connect<void>(std::move(host), port);
+}
+
+ssh::async<ssh::result<void>> session::connect(ssh::noerror_tag, std::string host, std::uint16_t port) {
+  return connect<ssh::result<void>>(std::move(host), port);
+}
+
+#if !SSH_OS_WIN32
+
+ssh::async<void> session::connect(ssh::net::tcp::socket socket, std::string host) {
+  return connect<void>(std::move(socket), std::move(host));
+}
+
+ssh::async<ssh::result<void>> session::connect(ssh::noerror_tag, ssh::net::tcp::socket socket, std::string host) {
+  return connect<ssh::result<void>>(std::move(socket), std::move(host));
+}
+
+#endif
+
+ssh::async<ssh::auth_result> session::auth_password(std::string user, std::string password) {
+  return auth_password<ssh::auth_result>(std::move(user), std::move(password));
 }
 
-ssh::async<void> session::connect(const net::endpoint& endpoint) {
-  endpoint.address().c_str();
-  ssh_options_set(handle(), SSH_OPTIONS_HOST, "localhost");
-  //ssh_options_set(handle(), SSH_OPTIONS_PORT, &port);
-  co_return;
+ssh::async<ssh::result<ssh::auth_result>> session::auth_password(ssh::noerror_tag, std::string user, std::string password) {
+  return auth_password<ssh::result<ssh::auth_result>>(std::move(user), std::move(password));
+}
+
+ssh::async<ssh::auth_result> session::auth_publickey(std::string user, std::string key, std::string passphrase) {
+  return auth_publickey<ssh::auth_result>(std::move(user), std::move(key), std::move(passphrase));
+}
+
+ssh::async<ssh::result<ssh::auth_result>> session::auth_publickey(ssh::noerror_tag, std::string user, std::string key, std::string passphrase) {
+  return auth_publickey<ssh::result<ssh::auth_result>>(std::move(user), std::move(key), std::move(passphrase));
+}
+
+ssh::async<ssh::auth_result> session::auth_agent(std::string user) {
+  return auth_agent<ssh::auth_result>(std::move(user));
+}
+
+ssh::async<ssh::result<ssh::auth_result>> session::auth_agent(ssh::noerror_tag, std::string user) {
+  return auth_agent<ssh::result<ssh::auth_result>>(std::move(user));
+}
+
+ssh::async<ssh::auth_result> session::authenticate(ssh::identity identity) {
+  return authenticate<ssh::auth_result>(std::move(identity));
+}
+
+ssh::async<ssh::result<ssh::auth_result>> session::authenticate(ssh::noerror_tag, ssh::identity identity) {
+  return authenticate<ssh::result<ssh::auth_result>>(std::move(identity));
+}
+
+ssh::async<void> session::flush() {
+  return flush<void>();
+}
+
+ssh::async<ssh::result<void>> session::flush(ssh::noerror_tag) {
+  return flush<ssh::result<void>>();
+}
+
+bool session::allowed(int method) noexcept {
+  const auto methods = ssh_userauth_list(handle(), nullptr);
+  return !methods || (methods & method);
+}
+
+session::wait_operation session::wait() noexcept {
+  // Pending output is flushed before a reply can arrive.
+  return wait_operation{ *this, (ssh_get_poll_flags(handle()) & SSH_WRITE_PENDING) != 0, true };
+}
+
+session::wait_operation session::wait(ssh::noerror_tag) noexcept {
+  return wait_operation{ *this, (ssh_get_poll_flags(handle()) & SSH_WRITE_PENDING) != 0, false };
+}
+
+void session::suspend(ssh::context::work& work, bool send) noexcept {
+  auto& direction = send ? send_ : recv_;
+  clear(send);
+  work.next = std::exchange(direction.waiters, &work);
+  if (!direction.alive) {
+    poll(send);
+  }
+}
+
+bool session::read_operation::await_ready() const noexcept {
+  return channel_.ready_ || channel_.session_.token_.is_cancellation_requested();
+}
+
+void session::read_operation::await_resume() const {
+  channel_.session_.check();
+}
+
+void session::read_operation::await_suspend(coroutine_handle<> handle) noexcept {
+  auto& session = channel_.session_;
+  channel_.work_.handle = handle;
+  channel_.work_.owner = ssh::context::current();
+  channel_.reading_ = true;
+  channel_.prev_ = nullptr;
+  channel_.next_ = std::exchange(session.readers_, &channel_);
+  if (channel_.next_) {
+    channel_.next_->prev_ = &channel_;
+  }
+  session.clear(false);
+  if (!session.recv_.alive) {
+    session.poll(false);
+  }
+}
+
+ssh::task session::poll(bool send) {
+  auto& direction = send ? send_ : recv_;
+  auto alive = true;
+  direction.alive = &alive;
+#if !SSH_OS_WIN32
+  const auto fd = ssh_get_fd(handle());
+  if (!registration_ || registration_->fd() != fd) {
+    std::lock_guard lock(registration_mutex_);
+    ssh::retire(*context_, std::move(registration_));
+    registration_ = std::make_unique<ssh::registration>(*context_, fd);
+  }
+  auto operation = send ? registration_->send() : registration_->recv();
+#endif
+  while (direction.waiters || (!send && readers_)) {
+#if SSH_OS_WIN32
+    co_await context_->schedule();
+#else
+    co_await operation;
+#endif
+    if (!send && readers_) {
+      // Process incoming packets. Channel callbacks move channels with new data to the ready list.
+      if (const auto rc = token_.is_cancellation_requested() ? SSH_ERROR : ssh_channel_poll(readers_->handle(), readers_->stream_); rc == SSH_ERROR) {
+        while (readers_) {
+          ready(*readers_);
+        }
+      } else if (rc == 0) {
+        clear(false);
+      }
+    }
+    // A resumed coroutine can destroy the session.
+    for (auto waiters = std::exchange(direction.waiters, nullptr); waiters && alive;) {
+      std::exchange(waiters, waiters->next)->handle.resume();
+    }
+    while (alive && ready_) {
+      auto& channel = *ready_;
+      remove(channel);
+      channel.work_.handle.resume();
+    }
+    if (!alive) {
+      co_return;
+    }
+  }
+  direction.alive = nullptr;
+}
+
+void session::clear([[maybe_unused]] bool send) noexcept {
+#if !SSH_OS_WIN32
+  if (registration_) {
+    (send ? registration_->send() : registration_->recv()).clear();
+  }
+#endif
+}
+
+void session::ready(ssh::channel& channel) noexcept {
+  remove(channel);
+  channel.queued_ = true;
+  channel.next_ = std::exchange(ready_, &channel);
+  if (channel.next_) {
+    channel.next_->prev_ = &channel;
+  }
+}
+
+void session::remove(ssh::channel& channel) noexcept {
+  if (channel.prev_) {
+    channel.prev_->next_ = channel.next_;
+  } else {
+    (channel.queued_ ? ready_ : readers_) = channel.next_;
+  }
+  if (channel.next_) {
+    channel.next_->prev_ = channel.prev_;
+  }
+  channel.reading_ = false;
+  channel.queued_ = false;
+  channel.prev_ = nullptr;
+  channel.next_ = nullptr;
+}
+
+void session::notify() noexcept {
+  // Called from inside the operations of other channels, so the readers are queued instead of resumed.
+  while (ready_) {
+    auto& channel = *ready_;
+    remove(channel);
+    context_->post(&channel.work_);
+  }
 }
 
-}  // namespace ssh::ssh
+}  // namespace ssh
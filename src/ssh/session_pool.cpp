@@ -0,0 +1,320 @@
+#include <ssh/session_pool.h>
+#include <ssh/exception.h>
+#include <libssh/libssh.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+
+namespace ssh {
+
+bool session_pool::key::operator==(const key& other) const noexcept {
+  // clang-format off
+  return
+    host == other.host &&
+    port == other.port &&
+    identity.user == other.identity.user &&
+    identity.agent == other.identity.agent &&
+    identity.key == other.identity.key &&
+    identity.passphrase == other.identity.passphrase &&
+    identity.password == other.identity.password;
+  // clang-format on
+}
+
+std::size_t session_pool::key_hash::operator()(const key& key) const noexcept {
+  auto hash = std::hash<std::string>{}(key.host);
+  hash = hash * 31 + key.port;
+  hash = hash * 31 + std::hash<std::string>{}(key.identity.user);
+  hash = hash * 31 + std::hash<std::string>{}(key.identity.key);
+  return hash;
+}
+
+session_pool::lease& session_pool::lease::operator=(lease&& other) noexcept {
+  if (this != std::addressof(other)) {
+    if (entry_) {
+      pool_->release(std::move(entry_), reuse_);
+    }
+    pool_ = other.pool_;
+    entry_ = std::move(other.entry_);
+    reuse_ = other.reuse_;
+  }
+  return *this;
+}
+
+session_pool::lease::~lease() {
+  if (entry_) {
+    pool_->release(std::move(entry_), reuse_);
+  }
+}
+
+void session_pool::wait_operation::await_suspend(coroutine_handle<> handle) noexcept {
+  work_.handle = handle;
+  work_.owner = ssh::context::current();
+  work_.next = std::exchange(host_.waiters, &work_);
+  lock_.unlock();
+}
+
+void session_pool::sweeper::start() noexcept {
+  armed_.store(true);
+  if (!pool_.context_.start(*this, clock::now() + pool_.options_.idle)) {
+    armed_.store(false, std::memory_order_release);
+  }
+}
+
+void session_pool::sweeper::stop() noexcept {
+  stopping_.store(true);
+  // The timer is either cancelled once the callback scheduled it again or released by the callback.
+  while (armed_.load(std::memory_order_acquire) && !pool_.context_.cancel(*this)) {
+    std::this_thread::yield();
+  }
+}
+
+void session_pool::sweeper::complete(timer& timer) noexcept {
+  auto& sweeper = static_cast<session_pool::sweeper&>(timer);
+  auto& pool = sweeper.pool_;
+  pool.expire();
+  // The pool may be destroyed as soon as the timer is scheduled again or released.
+  if (sweeper.stopping_.load() || !pool.context_.start(timer, clock::now() + pool.options_.idle)) {
+    sweeper.armed_.store(false, std::memory_order_release);
+  }
+}
+
+session_pool::session_pool(ssh::context& context) : session_pool(context, options{}) {
+}
+
+session_pool::session_pool(ssh::context& context, options options) : context_(context), options_(options), sweeper_(*this) {
+  if (options_.idle > clock::duration::zero()) {
+    sweeper_.start();
+  }
+}
+
+session_pool::~session_pool() {
+  sweeper_.stop();
+}
+
+ssh::async<session_pool::lease> session_pool::acquire(key key) {
+  while (true) {
+    std::vector<std::unique_ptr<entry>> closed;
+    ssh::context::work* waiters = nullptr;
+    std::unique_ptr<entry> entry;
+    auto create = false;
+    auto refill = false;
+    std::unique_lock lock(mutex_);
+    auto& bucket = find(key);
+    auto& host = *bucket.host;
+    const auto now = clock::now();
+    while (!entry && !bucket.idle.empty()) {
+      entry = std::move(bucket.idle.back());
+      bucket.idle.pop_back();
+      idle_--;
+      if (!usable(*entry, now)) {
+        closed.push_back(std::move(entry));
+        // Every closed session frees a slot, even when this call takes one of them.
+        if (const auto waiter = free(host)) {
+          waiter->next = std::exchange(waiters, waiter);
+        }
+      }
+    }
+    if (!entry && host.size >= options_.limit) {
+      // Replace the least recently used idle session of another key.
+      session_pool::bucket* victim = nullptr;
+      for (const auto other : host.buckets) {
+        if (!other->idle.empty() && (!victim || other->idle.front()->used < victim->idle.front()->used)) {
+          victim = other;
+        }
+      }
+      if (victim) {
+        closed.push_back(std::move(victim->idle.front()));
+        victim->idle.erase(victim->idle.begin());
+        idle_--;
+        host.size--;
+        size_--;
+      }
+    }
+    if (!entry && host.size < options_.limit) {
+      host.size++;
+      size_++;
+      create = true;
+    }
+    if (options_.warm > bucket.idle.size() + bucket.connecting && host.size < options_.limit) {
+      bucket.connecting++;
+      host.size++;
+      size_++;
+      refill = true;
+    }
+    if (!entry && !create) {
+      co_await wait_operation{ host, lock };
+      continue;
+    }
+    lock.unlock();
+    closed.clear();
+    while (waiters) {
+      std::exchange(waiters, waiters->next)->handle.resume();
+    }
+    if (refill) {
+      fill(bucket, key);
+    }
+    if (entry) {
+      co_return lease{ *this, std::move(entry) };
+    }
+    co_return lease{ *this, co_await connect(bucket, std::move(key)) };
+  }
+}
+
+ssh::async<void> session_pool::warm(key key) {
+  while (true) {
+    std::unique_lock lock(mutex_);
+    auto& bucket = find(key);
+    auto& host = *bucket.host;
+    if (bucket.idle.size() + bucket.connecting >= options_.warm || host.size >= options_.limit) {
+      break;
+    }
+    bucket.connecting++;
+    host.size++;
+    size_++;
+    lock.unlock();
+    std::unique_ptr<entry> entry;
+    try {
+      entry = co_await connect(bucket, key);
+    }
+    catch (...) {
+      std::lock_guard guard(mutex_);
+      bucket.connecting--;
+      throw;
+    }
+    lock.lock();
+    bucket.connecting--;
+    lock.unlock();
+    release(std::move(entry), true);
+  }
+}
+
+std::size_t session_pool::expire() {
+  std::vector<std::unique_ptr<entry>> closed;
+  ssh::context::work* waiters = nullptr;
+  {
+    std::lock_guard lock(mutex_);
+    const auto now = clock::now();
+    for (auto& [key, bucket] : buckets_) {
+      for (auto it = bucket.idle.begin(); it != bucket.idle.end();) {
+        if (usable(**it, now)) {
+          ++it;
+          continue;
+        }
+        closed.push_back(std::move(*it));
+        it = bucket.idle.erase(it);
+        idle_--;
+        if (const auto waiter = free(*bucket.host)) {
+          waiter->next = std::exchange(waiters, waiter);
+        }
+      }
+    }
+  }
+  const auto size = closed.size();
+  closed.clear();
+  while (waiters) {
+    std::exchange(waiters, waiters->next)->handle.resume();
+  }
+  return size;
+}
+
+std::size_t session_pool::size() const noexcept {
+  std::lock_guard lock(mutex_);
+  return size_;
+}
+
+std::size_t session_pool::idle() const noexcept {
+  std::lock_guard lock(mutex_);
+  return idle_;
+}
+
+session_pool::bucket& session_pool::find(const key& key) {
+  auto& bucket = buckets_[key];
+  if (!bucket.host) {
+    bucket.host = &hosts_[key.host];
+    bucket.host->buckets.push_back(&bucket);
+  }
+  return bucket;
+}
+
+ssh::async<std::unique_ptr<session_pool::entry>> session_pool::connect(bucket& bucket, key key) {
+  auto entry = std::make_unique<session_pool::entry>();
+  entry->bucket = &bucket;
+  try {
+    entry->session = std::make_unique<ssh::session>(context_);
+    co_await entry->session->connect(key.host, key.port);
+    if (co_await entry->session->authenticate(key.identity) != ssh::auth_result::success) {
+      throw ssh::domain_error("Authentication failed: " + key.host);
+    }
+  }
+  catch (...) {
+    entry->session.reset();
+    ssh::context::work* waiter = nullptr;
+    {
+      std::lock_guard lock(mutex_);
+      waiter = free(*bucket.host);
+    }
+    if (waiter) {
+      waiter->handle.resume();
+    }
+    throw;
+  }
+  entry->created = clock::now();
+  entry->used = entry->created;
+  co_return entry;
+}
+
+ssh::task session_pool::fill(bucket& bucket, key key) {
+  std::unique_ptr<entry> entry;
+  try {
+    entry = co_await connect(bucket, std::move(key));
+  }
+  catch (...) {
+  }
+  {
+    std::lock_guard lock(mutex_);
+    bucket.connecting--;
+  }
+  if (entry) {
+    release(std::move(entry), true);
+  }
+}
+
+void session_pool::release(std::unique_ptr<entry> entry, bool reuse) noexcept {
+  ssh::context::work* waiter = nullptr;
+  {
+    std::lock_guard lock(mutex_);
+    auto& bucket = *entry->bucket;
+    // A returned session also wakes a waiter of another key that can replace it.
+    waiter = std::exchange(bucket.host->waiters, bucket.host->waiters ? bucket.host->waiters->next : nullptr);
+    entry->used = clock::now();
+    if (reuse && usable(*entry, entry->used)) {
+      bucket.idle.push_back(std::move(entry));
+      idle_++;
+    } else {
+      bucket.host->size--;
+      size_--;
+    }
+  }
+  entry.reset();
+  if (waiter) {
+    waiter->handle.resume();
+  }
+}
+
+ssh::context::work* session_pool::free(host& host) noexcept {
+  host.size--;
+  size_--;
+  return std::exchange(host.waiters, host.waiters ? host.waiters->next : nullptr);
+}
+
+bool session_pool::usable(const entry& entry, clock::time_point now) const noexcept {
+  // clang-format off
+  return
+    (options_.idle == clock::duration::zero() || now - entry.used < options_.idle) &&
+    now - entry.created < options_.age &&
+    ssh_is_connected(entry.session->handle());
+  // clang-format on
+}
+
+}  // namespace ssh
@@ -0,0 +1,193 @@
+#pragma once
+#include <ssh/context.h>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace ssh {
+
+// Hierarchical timing wheel with 6 levels of 64 slots and a resolution of one tick.
+// Level n holds timers that expire within 64^(n + 1) ticks of the elapsed tick. Timers on higher
+// levels cascade to lower levels when their slot is reached. Insert and remove are O(1).
+class timer_wheel {
+public:
+  using timer = ssh::context::timer;
+
+  constexpr static std::uint64_t never = std::numeric_limits<std::uint64_t>::max();
+
+  bool empty() const noexcept {
+    return size_ == 0;
+  }
+
+  std::size_t size() const noexcept {
+    return size_;
+  }
+
+  std::uint64_t elapsed() const noexcept {
+    return elapsed_;
+  }
+
+  // Inserts a timer that expires at the tick. Ticks that are not after the elapsed tick expire with the next one.
+  void insert(timer& timer, std::uint64_t expiry) noexcept {
+    timer.expiry_ = std::max(expiry, elapsed_ + 1);
+    insert(timer);
+  }
+
+  void remove(timer& timer) noexcept {
+    auto& head = slots_[timer.level_][timer.slot_];
+    if (timer.prev_) {
+      timer.prev_->next_ = timer.next_;
+    } else {
+      head = timer.next_;
+    }
+    if (timer.next_) {
+      timer.next_->prev_ = timer.prev_;
+    }
+    if (!head) {
+      occupied_[timer.level_] &= ~(std::uint64_t(1) << timer.slot_);
+    }
+    timer.prev_ = nullptr;
+    timer.next_ = nullptr;
+    timer.scheduled_ = false;
+    size_--;
+  }
+
+  // Removes all timers and returns them linked by their next pointer.
+  timer* clear() noexcept {
+    timer* list = nullptr;
+    for (auto& level : slots_) {
+      for (auto& head : level) {
+        while (head) {
+          auto& timer = *std::exchange(head, head->next_);
+          timer.prev_ = nullptr;
+          timer.next_ = std::exchange(list, &timer);
+          timer.scheduled_ = false;
+        }
+      }
+    }
+    occupied_ = {};
+    size_ = 0;
+    return list;
+  }
+
+  // Returns the timer that follows in a list returned by advance or clear.
+  static timer* next(const timer& timer) noexcept {
+    return timer.next_;
+  }
+
+  // Returns the tick at which the next slot must be processed. This is never later than the
+  // earliest expiry, but can be earlier when the slot only cascades to lower levels.
+  std::uint64_t next() const noexcept {
+    std::size_t level = 0;
+    std::size_t slot = 0;
+    return next(level, slot);
+  }
+
+  // Advances the elapsed tick and returns the list of expired timers linked by their next pointer.
+  timer* advance(std::uint64_t now) noexcept {
+    timer* expired = nullptr;
+    auto last = &expired;
+    while (true) {
+      std::size_t level = 0;
+      std::size_t slot = 0;
+      const auto deadline = next(level, slot);
+      if (deadline > now) {
+        break;
+      }
+      elapsed_ = deadline;
+      auto entry = std::exchange(slots_[level][slot], nullptr);
+      occupied_[level] &= ~(std::uint64_t(1) << slot);
+      while (entry) {
+        auto& timer = *std::exchange(entry, entry->next_);
+        if (timer.expiry_ <= elapsed_) {
+          timer.prev_ = nullptr;
+          timer.next_ = nullptr;
+          timer.scheduled_ = false;
+          *last = &timer;
+          last = &timer.next_;
+          size_--;
+        } else {
+          size_--;
+          insert(timer);
+        }
+      }
+    }
+    if (now > elapsed_) {
+      elapsed_ = now;
+    }
+    return expired;
+  }
+
+private:
+  constexpr static std::size_t levels = 6;
+  constexpr static std::size_t slots = 64;
+  constexpr static std::size_t bits = 6;
+
+  // Inserts a timer that expires after the elapsed tick.
+  void insert(timer& timer) noexcept {
+    const auto level = level_of(timer.expiry_);
+    const auto slot = slot_of(timer.expiry_, level);
+    auto& head = slots_[level][slot];
+    timer.prev_ = nullptr;
+    timer.next_ = head;
+    if (head) {
+      head->prev_ = &timer;
+    }
+    head = &timer;
+    timer.level_ = static_cast<std::uint8_t>(level);
+    timer.slot_ = static_cast<std::uint8_t>(slot);
+    timer.scheduled_ = true;
+    occupied_[level] |= std::uint64_t(1) << slot;
+    size_++;
+  }
+
+  std::size_t level_of(std::uint64_t expiry) const noexcept {
+    const auto masked = (elapsed_ ^ expiry) | (slots - 1);
+    auto significant = 0;
+    for (auto value = masked; value > 1; value >>= 1) {
+      significant++;
+    }
+    const auto level = static_cast<std::size_t>(significant) / bits;
+    return level < levels ? level : levels - 1;
+  }
+
+  static std::size_t slot_of(std::uint64_t expiry, std::size_t level) noexcept {
+    return static_cast<std::size_t>((expiry >> (level * bits)) & (slots - 1));
+  }
+
+  std::uint64_t next(std::size_t& level, std::size_t& slot) const noexcept {
+    for (level = 0; level < levels; level++) {
+      const auto occupied = occupied_[level];
+      if (!occupied) {
+        continue;
+      }
+      const auto slot_range = std::uint64_t(1) << (level * bits);
+      const auto level_range = slot_range << bits;
+      // On higher levels the current slot can only hold timers that were clamped to the last level
+      // and wrapped around, so the search starts at the following slot.
+      const auto start = (slot_of(elapsed_, level) + (level > 0 ? 1 : 0)) & (slots - 1);
+      const auto rotated = start ? (occupied >> start) | (occupied << (slots - start)) : occupied;
+      auto zeros = std::size_t(0);
+      while (!(rotated & (std::uint64_t(1) << zeros))) {
+        zeros++;
+      }
+      slot = (zeros + start) & (slots - 1);
+      auto deadline = (elapsed_ & ~(level_range - 1)) + slot * slot_range;
+      if (deadline <= elapsed_ && level > 0) {
+        deadline += level_range;
+      }
+      return deadline;
+    }
+    return never;
+  }
+
+  std::array<std::array<timer*, slots>, levels> slots_ = {};
+  std::array<std::uint64_t, levels> occupied_ = {};
+  std::uint64_t elapsed_ = 0;
+  std::size_t size_ = 0;
+};
+
+}  // namespace ssh
@@ -0,0 +1,413 @@
+#include <ssh/config.h>
+
+#if SSH_OS_LINUX
+#include <ssh/uring.h>
+#include <ssh/event.h>
+#include <algorithm>
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ssh {
+namespace {
+
+// User data of the poll operation that watches the context epoll descriptor.
+constexpr std::uint64_t epoll_data = 0;
+
+// User data of timeout operations on kernels without IORING_FEAT_EXT_ARG (5.11). Registrations set the lowest bit
+// of their user data, so the remaining constants are even.
+constexpr std::uint64_t timeout_data = 2;
+
+// User data of the operations that wake up a waiting thread and remove the poll of a registration.
+constexpr std::uint64_t wake_data = 4;
+constexpr std::uint64_t remove_data = 6;
+
+static_assert(alignof(ssh::registration) > remove_data);
+
+// Number of entries in the probe that is used to check for supported operations.
+constexpr unsigned probe_size = 256;
+
+template <typename T>
+T* offset(void* base, std::uint32_t offset) noexcept {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+void* map(int fd, std::size_t size, off_t offset) noexcept {
+  const auto data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  return data == MAP_FAILED ? nullptr : data;
+}
+
+std::uint64_t data(ssh::registration& registration) noexcept {
+  return reinterpret_cast<std::uintptr_t>(&registration) | ssh::registration::tag;
+}
+
+}  // namespace
+
+std::unique_ptr<uring> uring::create(ssh::context& context, unsigned entries) noexcept {
+  std::unique_ptr<uring> ring(new (std::nothrow) uring(context));
+  if (!ring) {
+    return {};
+  }
+  io_uring_params params = {};
+  ring->handle_.reset(::syscall(__NR_io_uring_setup, entries, &params));
+  if (!ring->handle_) {
+    return {};
+  }
+  const auto fd = ring->handle_.value();
+  ring->features_ = params.features;
+  ring->multishot_.store(params.features & IORING_FEAT_RSRC_TAGS, std::memory_order_relaxed);
+
+  // Requires IORING_REGISTER_PROBE (5.6).
+  alignas(io_uring_probe) char probe_data[sizeof(io_uring_probe) + probe_size * sizeof(io_uring_probe_op)] = {};
+  const auto probe = reinterpret_cast<io_uring_probe*>(probe_data);
+  if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, probe_size) < 0) {
+    return {};
+  }
+  for (const auto op : { IORING_OP_NOP, IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE }) {
+    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      return {};
+    }
+  }
+
+  ring->sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->sq_size_ = std::max(ring->sq_size_, ring->cq_size_);
+    ring->cq_size_ = 0;
+  }
+  ring->sq_ = map(fd, ring->sq_size_, IORING_OFF_SQ_RING);
+  if (!ring->sq_) {
+    return {};
+  }
+  ring->cq_ = ring->cq_size_ ? map(fd, ring->cq_size_, IORING_OFF_CQ_RING) : ring->sq_;
+  if (!ring->cq_) {
+    return {};
+  }
+  ring->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqes_ = static_cast<io_uring_sqe*>(map(fd, ring->sqes_size_, IORING_OFF_SQES));
+  if (!ring->sqes_) {
+    return {};
+  }
+
+  ring->sq_head_ = offset<unsigned>(ring->sq_, params.sq_off.head);
+  ring->sq_tail_ = offset<unsigned>(ring->sq_, params.sq_off.tail);
+  ring->sq_array_ = offset<unsigned>(ring->sq_, params.sq_off.array);
+  ring->sq_mask_ = *offset<unsigned>(ring->sq_, params.sq_off.ring_mask);
+  ring->sq_entries_ = *offset<unsigned>(ring->sq_, params.sq_off.ring_entries);
+
+  ring->cq_head_ = offset<unsigned>(ring->cq_, params.cq_off.head);
+  ring->cq_tail_ = offset<unsigned>(ring->cq_, params.cq_off.tail);
+  ring->cq_mask_ = *offset<unsigned>(ring->cq_, params.cq_off.ring_mask);
+  ring->cqes_ = offset<io_uring_cqe>(ring->cq_, params.cq_off.cqes);
+
+  ring->epoll_ = context.handle().value();
+  std::lock_guard<std::mutex> lock(ring->sq_mutex_);
+  ring->arm(true);
+  return ring;
+}
+
+uring::~uring() {
+  // Closing the ring releases the polls of the removed registrations.
+  handle_.reset();
+  if (sqes_) {
+    ::munmap(sqes_, sqes_size_);
+  }
+  if (cq_ && cq_ != sq_) {
+    ::munmap(cq_, cq_size_);
+  }
+  if (sq_) {
+    ::munmap(sq_, sq_size_);
+  }
+  for (auto registration = owned_; registration;) {
+    delete std::exchange(registration, registration->next_);
+  }
+  for (auto registration = retired_; registration;) {
+    delete std::exchange(registration, registration->queue_);
+  }
+}
+
+bool uring::add(ssh::registration& registration) noexcept {
+  // A one-shot poll that is armed again after every completion would report writable sockets in a loop.
+  if (!multishot()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(sq_mutex_);
+  if (!poll(registration)) {
+    return false;
+  }
+  flush();
+  return true;
+}
+
+void uring::remove(ssh::registration& registration) noexcept {
+  std::lock_guard<std::mutex> lock(sq_mutex_);
+  registration.removed_ = true;
+  registration.prev_ = nullptr;
+  registration.next_ = owned_;
+  if (owned_) {
+    owned_->prev_ = &registration;
+  }
+  owned_ = &registration;
+  if (registration.queued_) {
+    return;
+  }
+  if (!registration.armed_) {
+    retire(registration);
+    return;
+  }
+  if (!cancel(registration)) {
+    enqueue(registration);
+    return;
+  }
+  // The poll keeps a reference to the socket, which is only closed once the removal was submitted.
+  flush();
+}
+
+bool uring::wake() noexcept {
+  std::lock_guard<std::mutex> lock(sq_mutex_);
+  const auto sqe = acquire();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_NOP;
+  sqe->fd = -1;
+  sqe->user_data = wake_data;
+  publish();
+  enter(pending(), 0, 0);
+  return true;
+}
+
+int uring::wait(int timeout, __kernel_timespec& storage, epoll_event* events, int size, ssh::context::work*& completions) noexcept {
+  const auto wait = timeout != 0 && !epoll_ready_.load(std::memory_order_acquire);
+  unsigned submit = 0;
+  {
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    for (auto registration = std::exchange(backlog_, nullptr); registration;) {
+      auto& entry = *std::exchange(registration, registration->queue_);
+      entry.queued_ = false;
+      if (entry.removed_ && !entry.armed_) {
+        retire(entry);
+      } else if (entry.removed_ ? !cancel(entry) : !poll(entry)) {
+        enqueue(entry);
+      }
+    }
+    if (wait && timeout > 0 && !ext_arg()) {
+      if (const auto sqe = acquire()) {
+        storage.tv_sec = timeout / 1000;
+        storage.tv_nsec = (timeout % 1000) * 1000000;
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<std::uint64_t>(&storage);
+        sqe->len = 1;
+        sqe->user_data = timeout_data;
+        publish();
+      }
+    }
+    submit = pending();
+    if (wait) {
+      waiting_++;
+    }
+  }
+  const auto entered = enter(submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, wait ? timeout : -1);
+  const auto error = errno;
+  if (wait) {
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    waiting_--;
+  }
+  if (entered < 0 && error != EINTR && error != EAGAIN && error != EBUSY && error != ETIME) {
+    errno = error;
+    return -1;
+  }
+
+  auto epoll_ready = epoll_ready_.exchange(false, std::memory_order_acq_rel);
+  auto rearm = false;
+  auto last = &completions;
+  {
+    std::lock_guard<std::mutex> lock(cq_mutex_);
+    auto head = *cq_head_;
+    const auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    // Pairs with publish() so that registrations armed on other threads are visible without relying on the kernel.
+    [[maybe_unused]] const auto submitted = __atomic_load_n(sq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const auto& cqe = cqes_[head & cq_mask_];
+      if (cqe.user_data & ssh::registration::tag) {
+        auto& registration = *reinterpret_cast<ssh::registration*>(cqe.user_data & ~ssh::registration::tag);
+        if (cqe.res > 0) {
+          const auto [recv, send] = registration.complete(static_cast<std::uint32_t>(cqe.res));
+          for (const auto work : { recv, send }) {
+            if (work) {
+              work->next = nullptr;
+              *last = work;
+              last = &work->next;
+            }
+          }
+        }
+        // The kernel ends a multishot poll when it was removed or could not post a completion.
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          std::lock_guard<std::mutex> lock(sq_mutex_);
+          release(registration);
+        }
+        continue;
+      }
+      if (cqe.user_data == timeout_data || cqe.user_data == wake_data || cqe.user_data == remove_data) {
+        continue;
+      }
+      if (cqe.user_data == epoll_data) {
+        if (cqe.res == -EINVAL && multishot_.load(std::memory_order_relaxed)) {
+          // Multishot poll requires Linux 5.13. Fall back to re-arming a one-shot poll.
+          multishot_.store(false, std::memory_order_relaxed);
+        } else {
+          epoll_ready = true;
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          rearm = true;
+        }
+        continue;
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+  ssh::registration* retired = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    if (rearm) {
+      arm(multishot_.load(std::memory_order_relaxed));
+    }
+    retired = std::exchange(retired_, nullptr);
+  }
+  // Workers may still resume coroutines that earlier completions of the poll returned.
+  while (retired) {
+    context_.retire(std::exchange(retired, retired->queue_));
+  }
+  if (!epoll_ready) {
+    return 0;
+  }
+  const auto count = ::epoll_wait(epoll_, events, size, 0);
+  if (count == size) {
+    // The multishot poll only reports new wakeups. Poll again until the epoll descriptor is drained.
+    epoll_ready_.store(true, std::memory_order_release);
+  }
+  return count;
+}
+
+io_uring_sqe* uring::acquire() noexcept {
+  const auto tail = *sq_tail_;
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+    enter(pending(), 0, 0);
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+      return nullptr;
+    }
+  }
+  const auto index = tail & sq_mask_;
+  const auto sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(io_uring_sqe));
+  sq_array_[index] = index;
+  return sqe;
+}
+
+void uring::publish() noexcept {
+  __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+}
+
+unsigned uring::pending() const noexcept {
+  return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+void uring::flush() noexcept {
+  // Operations are submitted in batches by wait(). Only a blocked thread forces an early submission.
+  if (waiting_ > 0) {
+    enter(pending(), 0, 0);
+  }
+}
+
+void uring::arm(bool multishot) noexcept {
+  if (const auto sqe = acquire()) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = epoll_;
+    sqe->poll32_events = POLLIN;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = epoll_data;
+    publish();
+  }
+}
+
+bool uring::poll(ssh::registration& registration) noexcept {
+  const auto sqe = acquire();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = registration.fd();
+  sqe->poll32_events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = data(registration);
+  publish();
+  registration.armed_ = true;
+  return true;
+}
+
+bool uring::cancel(ssh::registration& registration) noexcept {
+  const auto sqe = acquire();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = data(registration);
+  sqe->user_data = remove_data;
+  publish();
+  return true;
+}
+
+void uring::enqueue(ssh::registration& registration) noexcept {
+  registration.queued_ = true;
+  registration.queue_ = std::exchange(backlog_, &registration);
+}
+
+void uring::retire(ssh::registration& registration) noexcept {
+  if (registration.prev_) {
+    registration.prev_->next_ = registration.next_;
+  } else {
+    owned_ = registration.next_;
+  }
+  if (registration.next_) {
+    registration.next_->prev_ = registration.prev_;
+  }
+  registration.queue_ = std::exchange(retired_, &registration);
+}
+
+void uring::release(ssh::registration& registration) noexcept {
+  registration.armed_ = false;
+  // A queued registration is retired or armed again by the next wait.
+  if (registration.queued_) {
+    return;
+  }
+  if (registration.removed_) {
+    retire(registration);
+  } else if (!poll(registration)) {
+    enqueue(registration);
+  }
+}
+
+int uring::enter(unsigned submit, unsigned complete, unsigned flags, int timeout) noexcept {
+#ifdef IORING_ENTER_EXT_ARG
+  if (timeout > 0 && ext_arg()) {
+    __kernel_timespec ts = {};
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    io_uring_getevents_arg arg = {};
+    arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+    flags |= IORING_ENTER_EXT_ARG;
+    return static_cast<int>(::syscall(__NR_io_uring_enter, handle_.value(), submit, complete, flags, &arg, sizeof(arg)));
+  }
+#endif
+  return static_cast<int>(::syscall(__NR_io_uring_enter, handle_.value(), submit, complete, flags, nullptr, 0));
+}
+
+}  // namespace ssh
+
+#endif
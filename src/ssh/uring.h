@@ -0,0 +1,137 @@
+#pragma once
+#include <ssh/context.h>
+#include <ssh/handle.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+#if SSH_OS_LINUX
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI (1U << 0)
+#endif
+
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+// Added in Linux 5.13 together with multishot poll.
+#ifndef IORING_FEAT_RSRC_TAGS
+#define IORING_FEAT_RSRC_TAGS (1U << 10)
+#endif
+
+namespace ssh {
+
+class registration;
+
+// Optional io_uring backend for ssh::context on Linux.
+// Registrations are watched with one multishot poll per descriptor, whose completions are dispatched
+// directly by wait(). Polls are written to the submission queue without entering the kernel and are
+// submitted in batches by the next wait() call. The context epoll descriptor is watched with another
+// poll so that ssh::event and registrations on kernels without multishot poll keep working.
+class uring {
+public:
+  // Returns nullptr when io_uring or one of the required operations is not supported by the kernel.
+  static std::unique_ptr<uring> create(ssh::context& context, unsigned entries = 4096) noexcept;
+
+  uring(uring&& other) = delete;
+  uring& operator=(uring&& other) = delete;
+
+  uring(const uring& other) = delete;
+  uring& operator=(const uring& other) = delete;
+
+  // Destroys the registrations that were removed but not released by the kernel yet.
+  ~uring();
+
+  // Watches the descriptor of the registration with a multishot poll instead of epoll.
+  // Returns false when the kernel does not support multishot poll or the submission queue is full.
+  bool add(ssh::registration& registration) noexcept;
+
+  // Removes the poll of the registration and takes ownership of it. The registration is retired on the
+  // context once the kernel posted the last completion of its poll.
+  void remove(ssh::registration& registration) noexcept;
+
+  // Wakes up a thread that is blocked in wait(). Returns false when the submission queue is full.
+  bool wake() noexcept;
+
+  // Submits pending operations and waits for completions or until the timeout in milliseconds expires.
+  // A negative timeout waits indefinitely. Kernels without IORING_FEAT_EXT_ARG read the timeout from the
+  // storage when another thread submits it, so every caller passes storage that outlives the call.
+  // The run queue entries that registrations returned for their completions are linked to the completions list.
+  // Returns the number of epoll events written to the events array or -1 on error.
+  int wait(int timeout, __kernel_timespec& storage, epoll_event* events, int size, ssh::context::work*& completions) noexcept;
+
+  bool multishot() const noexcept {
+    return multishot_.load(std::memory_order_relaxed);
+  }
+
+private:
+  explicit uring(ssh::context& context) noexcept : context_(context) {
+  }
+
+  // The following functions must be called with the submission queue mutex locked.
+  io_uring_sqe* acquire() noexcept;
+  void publish() noexcept;
+  unsigned pending() const noexcept;
+  void flush() noexcept;
+  void arm(bool multishot) noexcept;
+  bool poll(ssh::registration& registration) noexcept;
+  bool cancel(ssh::registration& registration) noexcept;
+  void enqueue(ssh::registration& registration) noexcept;
+  void retire(ssh::registration& registration) noexcept;
+  void release(ssh::registration& registration) noexcept;
+
+  int enter(unsigned submit, unsigned complete, unsigned flags, int timeout = -1) noexcept;
+
+  bool ext_arg() const noexcept {
+#ifdef IORING_FEAT_EXT_ARG
+    return features_ & IORING_FEAT_EXT_ARG;
+#else
+    return false;
+#endif
+  }
+
+  ssh::context& context_;
+  ssh::handle handle_;
+  int epoll_ = -1;
+
+  void* sq_ = nullptr;
+  std::size_t sq_size_ = 0;
+  void* cq_ = nullptr;
+  std::size_t cq_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  std::size_t sqes_size_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+
+  std::mutex sq_mutex_;
+  std::mutex cq_mutex_;
+  unsigned features_ = 0;
+  unsigned waiting_ = 0;
+  std::atomic_bool multishot_ = true;
+  std::atomic_bool epoll_ready_ = false;
+
+  // Registrations whose poll could not be armed or removed because the submission queue was full.
+  ssh::registration* backlog_ = nullptr;
+
+  // Removed registrations whose poll was not released yet and registrations that are ready to be retired.
+  ssh::registration* owned_ = nullptr;
+  ssh::registration* retired_ = nullptr;
+};
+
+}  // namespace ssh
+
+#endif
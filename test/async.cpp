@@ -0,0 +1,84 @@
+#include <ssh/async.h>
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace {
+
+// Deep enough that resuming every level with a nested call would overflow the stack.
+constexpr int depth = 100000;
+
+ssh::async<int> leaf(ssh::async_manual_reset_event& event) {
+  co_await event;
+  co_return 0;
+}
+
+ssh::async<int> link(ssh::async<int>& previous) {
+  co_return co_await previous + 1;
+}
+
+ssh::async_generator<int> numbers(int count) {
+  for (auto i = 0; i < count; i++) {
+    co_yield i;
+  }
+}
+
+ssh::async_generator<int> doubled(ssh::async_generator<int> numbers) {
+  auto it = co_await numbers.begin();
+  while (it != numbers.end()) {
+    co_yield *it * 2;
+    co_await ++it;
+  }
+}
+
+ssh::task sum(ssh::async_generator<int> values, long long& result, bool& done) {
+  auto it = co_await values.begin();
+  while (it != values.end()) {
+    result += *it;
+    co_await ++it;
+  }
+  done = true;
+}
+
+ssh::task count(ssh::async_mutex& mutex, int& counter) {
+  auto lock = co_await mutex.scoped_lock_async();
+  counter++;
+}
+
+TEST(async, completes_long_chains_of_awaiting_tasks) {
+  ssh::async_manual_reset_event event;
+  // Every task awaits the previous one, so completing the leaf completes all of them in one call.
+  std::vector<ssh::async<int>> chain;
+  chain.reserve(depth + 1);
+  chain.push_back(leaf(event));
+  for (auto i = 0; i < depth; i++) {
+    chain.push_back(link(chain.back()));
+  }
+  EXPECT_FALSE(chain.back().is_ready());
+  event.set();
+  ASSERT_TRUE(chain.back().is_ready());
+  EXPECT_EQ(chain.back().operator co_await().await_resume(), depth);
+}
+
+TEST(async, iterates_generators_over_generators) {
+  long long result = 0;
+  bool done = false;
+  sum(doubled(numbers(depth)), result, done);
+  EXPECT_TRUE(done);
+  EXPECT_EQ(result, static_cast<long long>(depth) * (depth - 1));
+}
+
+TEST(async, hands_a_mutex_through_many_waiters) {
+  ssh::async_mutex mutex;
+  ASSERT_TRUE(mutex.try_lock());
+  int counter = 0;
+  for (auto i = 0; i < depth; i++) {
+    count(mutex, counter);
+  }
+  EXPECT_EQ(counter, 0);
+  mutex.unlock();
+  EXPECT_EQ(counter, depth);
+  EXPECT_TRUE(mutex.try_lock());
+  mutex.unlock();
+}
+
+}  // namespace
@@ -0,0 +1,139 @@
+#include <ssh/async.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace {
+
+using ssh::detail::frame_pool;
+
+// Allocator that counts the frames it allocated and the threads they were returned on.
+class counting_allocator final : public ssh::frame_allocator {
+public:
+  void* allocate(std::size_t size) override {
+    allocated++;
+    return ::operator new(size);
+  }
+
+  void deallocate(void* data, std::size_t /*size*/) noexcept override {
+    deallocated++;
+    if (std::this_thread::get_id() != owner) {
+      remote++;
+    }
+    ::operator delete(data);
+  }
+
+  std::thread::id owner = std::this_thread::get_id();
+  std::atomic_size_t allocated = 0;
+  std::atomic_size_t deallocated = 0;
+  std::atomic_size_t remote = 0;
+};
+
+ssh::async<int> value(int value) {
+  co_return value;
+}
+
+TEST(frame_pool, reuses_frames_of_the_same_size_class) {
+  auto& pool = frame_pool::local();
+  const auto first = pool.allocate(200);
+  pool.deallocate(first, 200);
+  const auto second = pool.allocate(250);
+  EXPECT_EQ(second, first);
+  pool.deallocate(second, 250);
+}
+
+TEST(frame_pool, reclaims_frames_destroyed_on_other_threads) {
+  // The largest size class is not used by any other test on this thread, so its free list starts empty.
+  constexpr auto size = frame_pool::granularity * frame_pool::classes;
+  auto& pool = frame_pool::local();
+  std::vector<void*> frames;
+  for (auto i = 0; i < 8; i++) {
+    frames.push_back(pool.allocate(size));
+  }
+  std::thread([&]() {
+    for (const auto frame : frames) {
+      pool.deallocate(frame, size);
+    }
+  }).join();
+  std::vector<void*> reclaimed;
+  for (std::size_t i = 0; i < frames.size(); i++) {
+    reclaimed.push_back(pool.allocate(size));
+  }
+  std::sort(frames.begin(), frames.end());
+  std::sort(reclaimed.begin(), reclaimed.end());
+  EXPECT_EQ(reclaimed, frames);
+  for (const auto frame : reclaimed) {
+    pool.deallocate(frame, size);
+  }
+}
+
+TEST(frame_pool, frees_frames_returned_after_the_thread_exited) {
+  frame_pool* pool = nullptr;
+  std::vector<void*> frames;
+  std::thread([&]() {
+    pool = &frame_pool::local();
+    for (auto i = 0; i < 64; i++) {
+      frames.push_back(pool->allocate(64 + i * 16));
+    }
+    // One frame is returned before the thread exits and stays in its free list.
+    pool->deallocate(frames.back(), 64 + 63 * 16);
+    frames.pop_back();
+  }).join();
+  // The last returned frame deletes the closed pool.
+  for (std::size_t i = 0; i < frames.size(); i++) {
+    pool->deallocate(frames[i], 64 + i * 16);
+  }
+}
+
+TEST(frame_pool, returns_coroutine_frames_to_the_allocating_thread) {
+  counting_allocator allocator;
+  const auto previous = ssh::set_frame_allocator(&allocator);
+  std::vector<ssh::async<int>> tasks;
+  for (auto i = 0; i < 100; i++) {
+    tasks.push_back(value(i));
+  }
+  ssh::set_frame_allocator(previous);
+  EXPECT_EQ(allocator.allocated, 100u);
+  std::thread([&]() {
+    tasks.clear();
+  }).join();
+  EXPECT_EQ(allocator.deallocated, 100u);
+  EXPECT_EQ(allocator.remote, 100u);
+}
+
+TEST(frame_pool, survives_concurrent_remote_frees) {
+  constexpr auto rounds = 200;
+  constexpr auto count = 64;
+  std::atomic<std::vector<ssh::async<int>>*> handoff = nullptr;
+  std::atomic_int sum = 0;
+  std::thread consumer([&]() {
+    for (auto round = 0; round < rounds; round++) {
+      std::vector<ssh::async<int>>* tasks = nullptr;
+      while (!(tasks = handoff.exchange(nullptr, std::memory_order_acquire))) {
+        std::this_thread::yield();
+      }
+      for (auto& task : *tasks) {
+        sum += task.is_ready() ? 1 : 0;
+      }
+      delete tasks;
+    }
+  });
+  for (auto round = 0; round < rounds; round++) {
+    // Frames destroyed by the consumer are reclaimed by the allocations of the next round.
+    auto tasks = new std::vector<ssh::async<int>>();
+    for (auto i = 0; i < count; i++) {
+      tasks->push_back(value(i));
+    }
+    while (handoff.load(std::memory_order_relaxed)) {
+      std::this_thread::yield();
+    }
+    handoff.store(tasks, std::memory_order_release);
+  }
+  consumer.join();
+  EXPECT_EQ(sum, rounds * count);
+}
+
+}  // namespace
@@ -0,0 +1,100 @@
+#include <ssh/async.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+ssh::task acquire(ssh::async_semaphore& semaphore, std::vector<int>& order, int id) {
+  co_await semaphore.acquire_async();
+  order.push_back(id);
+}
+
+// Holds a permit while it counts the coroutines that hold one at the same time.
+ssh::task hold(ssh::async_semaphore& semaphore, std::atomic_int& active, std::atomic_int& peak, std::atomic_int& completed) {
+  auto lock = co_await semaphore.scoped_acquire_async();
+  const auto count = ++active;
+  auto maximum = peak.load();
+  while (count > maximum && !peak.compare_exchange_weak(maximum, count)) {
+  }
+  std::this_thread::yield();
+  active--;
+  completed++;
+}
+
+TEST(async_semaphore, acquires_available_permits_without_suspending) {
+  ssh::async_semaphore semaphore(2);
+  EXPECT_TRUE(semaphore.try_acquire());
+  EXPECT_TRUE(semaphore.try_acquire());
+  EXPECT_FALSE(semaphore.try_acquire());
+  EXPECT_EQ(semaphore.available(), 0u);
+  semaphore.release(2);
+  EXPECT_EQ(semaphore.available(), 2u);
+}
+
+TEST(async_semaphore, resumes_waiters_in_order) {
+  ssh::async_semaphore semaphore(0);
+  std::vector<int> order;
+  for (auto id = 0; id < 4; id++) {
+    acquire(semaphore, order, id);
+  }
+  EXPECT_TRUE(order.empty());
+  semaphore.release();
+  EXPECT_EQ(order, std::vector<int>({ 0 }));
+  semaphore.release(2);
+  EXPECT_EQ(order, std::vector<int>({ 0, 1, 2 }));
+  // Permits that are released beyond the waiters stay available.
+  semaphore.release(3);
+  EXPECT_EQ(order, std::vector<int>({ 0, 1, 2, 3 }));
+  EXPECT_EQ(semaphore.available(), 2u);
+}
+
+TEST(async_semaphore, takes_no_permit_for_an_operation_that_is_not_awaited) {
+  ssh::async_semaphore semaphore(1);
+  {
+    auto operation = semaphore.acquire_async();
+    static_cast<void>(operation);
+  }
+  EXPECT_EQ(semaphore.available(), 1u);
+  EXPECT_TRUE(semaphore.try_acquire());
+}
+
+TEST(async_semaphore, releases_the_permit_of_a_scoped_lock) {
+  ssh::async_semaphore semaphore(1);
+  std::atomic_int active = 0;
+  std::atomic_int peak = 0;
+  std::atomic_int completed = 0;
+  hold(semaphore, active, peak, completed);
+  EXPECT_EQ(completed, 1);
+  EXPECT_EQ(semaphore.available(), 1u);
+}
+
+TEST(async_semaphore, limits_concurrent_holders_under_contention) {
+  constexpr auto limit = 3u;
+  constexpr auto threads = 8;
+  constexpr auto iterations = 2000;
+  ssh::async_semaphore semaphore(limit);
+  std::atomic_int active = 0;
+  std::atomic_int peak = 0;
+  std::atomic_int completed = 0;
+  std::vector<std::thread> workers;
+  for (auto i = 0; i < threads; i++) {
+    // Waiters are resumed by whichever thread releases the permit they get.
+    workers.emplace_back([&]() {
+      for (auto j = 0; j < iterations; j++) {
+        hold(semaphore, active, peak, completed);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(completed, threads * iterations);
+  EXPECT_LE(peak, static_cast<int>(limit));
+  EXPECT_EQ(active, 0);
+  EXPECT_EQ(semaphore.available(), limit);
+}
+
+}  // namespace
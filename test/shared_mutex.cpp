@@ -0,0 +1,118 @@
+#include <ssh/async.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Takes the lock and records it without releasing it, so that the test decides when it is unlocked.
+ssh::task lock(ssh::async_shared_mutex& mutex, bool shared, std::string& log, char id) {
+  co_await (shared ? mutex.lock_shared_async() : mutex.lock_async());
+  log += id;
+}
+
+TEST(async_shared_mutex, excludes_readers_and_writers_while_a_writer_holds_it) {
+  ssh::async_shared_mutex mutex;
+  ASSERT_TRUE(mutex.try_lock());
+  EXPECT_FALSE(mutex.try_lock());
+  EXPECT_FALSE(mutex.try_lock_shared());
+  mutex.unlock();
+  ASSERT_TRUE(mutex.try_lock_shared());
+  EXPECT_TRUE(mutex.try_lock_shared());
+  EXPECT_FALSE(mutex.try_lock());
+  mutex.unlock_shared();
+  EXPECT_FALSE(mutex.try_lock());
+  mutex.unlock_shared();
+  EXPECT_TRUE(mutex.try_lock());
+  mutex.unlock();
+}
+
+TEST(async_shared_mutex, resumes_consecutive_readers_together) {
+  ssh::async_shared_mutex mutex;
+  ASSERT_TRUE(mutex.try_lock());
+  std::string log;
+  lock(mutex, true, log, 'a');
+  lock(mutex, true, log, 'b');
+  lock(mutex, false, log, 'W');
+  lock(mutex, true, log, 'c');
+  EXPECT_EQ(log, "");
+  mutex.unlock();
+  EXPECT_EQ(log, "ab");
+  // A reader does not join the group while a writer is queued behind it.
+  EXPECT_FALSE(mutex.try_lock_shared());
+  mutex.unlock_shared();
+  EXPECT_EQ(log, "ab");
+  mutex.unlock_shared();
+  EXPECT_EQ(log, "abW");
+  mutex.unlock();
+  EXPECT_EQ(log, "abWc");
+  mutex.unlock_shared();
+  EXPECT_TRUE(mutex.try_lock());
+  mutex.unlock();
+}
+
+TEST(async_shared_mutex, lets_readers_join_a_group_without_waiters) {
+  ssh::async_shared_mutex mutex;
+  std::string log;
+  lock(mutex, true, log, 'a');
+  lock(mutex, true, log, 'b');
+  EXPECT_EQ(log, "ab");
+  lock(mutex, false, log, 'W');
+  EXPECT_EQ(log, "ab");
+  mutex.unlock_shared();
+  mutex.unlock_shared();
+  EXPECT_EQ(log, "abW");
+  mutex.unlock();
+}
+
+TEST(async_shared_mutex, keeps_writers_exclusive_under_contention) {
+  constexpr auto threads = 8;
+  constexpr auto iterations = 2000;
+  ssh::async_shared_mutex mutex;
+  std::atomic_int readers = 0;
+  std::atomic_int writers = 0;
+  std::atomic_int violations = 0;
+  std::atomic_int completed = 0;
+  const auto read = [&]() -> ssh::task {
+    auto lock = co_await mutex.scoped_lock_shared_async();
+    if (writers != 0) {
+      violations++;
+    }
+    readers++;
+    std::this_thread::yield();
+    readers--;
+    completed++;
+  };
+  const auto write = [&]() -> ssh::task {
+    auto lock = co_await mutex.scoped_lock_async();
+    if (++writers != 1 || readers != 0) {
+      violations++;
+    }
+    std::this_thread::yield();
+    writers--;
+    completed++;
+  };
+  std::vector<std::thread> workers;
+  for (auto i = 0; i < threads; i++) {
+    workers.emplace_back([&, i]() {
+      for (auto j = 0; j < iterations; j++) {
+        if ((i + j) % 4 == 0) {
+          write();
+        } else {
+          read();
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(violations, 0);
+  EXPECT_EQ(completed, threads * iterations);
+  EXPECT_TRUE(mutex.try_lock());
+  mutex.unlock();
+}
+
+}  // namespace
@@ -0,0 +1,196 @@
+#include <ssh/timer.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+#include <cstdint>
+
+namespace {
+
+struct entry : ssh::context::timer {
+  explicit entry(std::uint64_t expiry) noexcept : timer(nullptr), expiry(expiry) {
+  }
+
+  std::uint64_t expiry = 0;
+  std::uint64_t expired = 0;
+  bool scheduled = false;
+};
+
+// Wheel that records the tick at which every entry expired.
+class wheel {
+public:
+  void insert(entry& entry) {
+    wheel_.insert(entry, entry.expiry);
+    entry.scheduled = true;
+  }
+
+  void remove(entry& entry) {
+    wheel_.remove(entry);
+    entry.scheduled = false;
+  }
+
+  std::size_t advance(std::uint64_t now) {
+    std::size_t count = 0;
+    for (auto timer = wheel_.advance(now); timer;) {
+      auto& expired = static_cast<entry&>(*timer);
+      timer = ssh::timer_wheel::next(*timer);
+      EXPECT_TRUE(expired.scheduled);
+      expired.expired = now;
+      expired.scheduled = false;
+      count++;
+    }
+    return count;
+  }
+
+  ssh::timer_wheel* operator->() noexcept {
+    return &wheel_;
+  }
+
+private:
+  ssh::timer_wheel wheel_;
+};
+
+TEST(timer_wheel, expires_on_first_level) {
+  wheel wheel;
+  entry a(1);
+  entry b(63);
+  wheel.insert(a);
+  wheel.insert(b);
+  EXPECT_EQ(wheel->size(), 2u);
+  EXPECT_EQ(wheel->next(), 1u);
+  EXPECT_EQ(wheel.advance(1), 1u);
+  EXPECT_EQ(a.expired, 1u);
+  EXPECT_EQ(wheel.advance(62), 0u);
+  EXPECT_EQ(wheel.advance(63), 1u);
+  EXPECT_EQ(b.expired, 63u);
+  EXPECT_TRUE(wheel->empty());
+  EXPECT_EQ(wheel->next(), ssh::timer_wheel::never);
+}
+
+TEST(timer_wheel, cascades_between_levels) {
+  // Expiries at and around the boundaries of every level.
+  std::vector<std::uint64_t> expiries;
+  for (std::uint64_t range = 64; range <= (std::uint64_t(1) << 36); range <<= 6) {
+    for (const auto expiry : { range - 1, range, range + 1, range * 3 + 17 }) {
+      expiries.push_back(expiry);
+    }
+  }
+  wheel wheel;
+  std::vector<std::unique_ptr<entry>> entries;
+  for (const auto expiry : expiries) {
+    entries.push_back(std::make_unique<entry>(expiry));
+    wheel.insert(*entries.back());
+  }
+  std::sort(expiries.begin(), expiries.end());
+  expiries.erase(std::unique(expiries.begin(), expiries.end()), expiries.end());
+  for (const auto expiry : expiries) {
+    wheel.advance(expiry - 1);
+    for (const auto& entry : entries) {
+      EXPECT_EQ(entry->scheduled, entry->expiry >= expiry) << entry->expiry;
+    }
+    EXPECT_GT(wheel.advance(expiry), 0u);
+  }
+  for (const auto& entry : entries) {
+    EXPECT_EQ(entry->expired, entry->expiry);
+  }
+  EXPECT_TRUE(wheel->empty());
+}
+
+TEST(timer_wheel, clamps_expiries_beyond_the_last_level) {
+  wheel wheel;
+  const auto expiry = (std::uint64_t(1) << 40) + 5;
+  entry entry(expiry);
+  wheel.insert(entry);
+  EXPECT_EQ(wheel.advance(expiry - 1), 0u);
+  EXPECT_TRUE(entry.scheduled);
+  EXPECT_EQ(wheel.advance(expiry), 1u);
+  EXPECT_EQ(entry.expired, expiry);
+}
+
+TEST(timer_wheel, cancels_timers) {
+  wheel wheel;
+  entry a(10);
+  entry b(10);
+  entry c(5000);
+  wheel.insert(a);
+  wheel.insert(b);
+  wheel.insert(c);
+  wheel.remove(a);
+  wheel.remove(c);
+  EXPECT_EQ(wheel->size(), 1u);
+  EXPECT_EQ(wheel->next(), 10u);
+  EXPECT_EQ(wheel.advance(10000), 1u);
+  EXPECT_EQ(a.expired, 0u);
+  EXPECT_EQ(b.expired, 10000u);
+  EXPECT_EQ(c.expired, 0u);
+  EXPECT_TRUE(wheel->empty());
+  EXPECT_EQ(wheel->next(), ssh::timer_wheel::never);
+}
+
+TEST(timer_wheel, clamps_expired_ticks_to_the_next_tick) {
+  wheel wheel;
+  wheel.advance(100);
+  entry entry(50);
+  wheel.insert(entry);
+  EXPECT_EQ(wheel->next(), 101u);
+  EXPECT_EQ(wheel.advance(100), 0u);
+  EXPECT_EQ(wheel.advance(101), 1u);
+}
+
+TEST(timer_wheel, clears_all_timers) {
+  wheel wheel;
+  entry a(3);
+  entry b(300000);
+  wheel.insert(a);
+  wheel.insert(b);
+  std::size_t count = 0;
+  for (auto timer = wheel->clear(); timer; timer = ssh::timer_wheel::next(*timer)) {
+    count++;
+  }
+  EXPECT_EQ(count, 2u);
+  EXPECT_TRUE(wheel->empty());
+  EXPECT_EQ(wheel->next(), ssh::timer_wheel::never);
+}
+
+// Compares the wheel with the expiries of randomly inserted, cancelled and advanced timers.
+// Timers never expire early and never later than the first advance past their expiry.
+TEST(timer_wheel, matches_brute_force) {
+  std::mt19937_64 random(7);
+  wheel wheel;
+  std::vector<std::unique_ptr<entry>> entries;
+  std::uint64_t now = 0;
+  for (auto round = 0; round < 2000; round++) {
+    for (auto i = random() % 8; i > 0; i--) {
+      const auto range = std::uint64_t(1) << (random() % 30);
+      entries.push_back(std::make_unique<entry>(now + 1 + random() % range));
+      wheel.insert(*entries.back());
+    }
+    if (!entries.empty() && random() % 4 == 0) {
+      auto& entry = *entries[random() % entries.size()];
+      if (entry.scheduled) {
+        wheel.remove(entry);
+      }
+    }
+    const auto next = wheel->next();
+    for (const auto& entry : entries) {
+      if (entry->scheduled) {
+        ASSERT_LE(next, entry->expiry);
+      }
+    }
+    now += random() % 2 ? random() % 64 : random() % (std::uint64_t(1) << (random() % 24));
+    wheel.advance(now);
+    std::size_t scheduled = 0;
+    for (const auto& entry : entries) {
+      if (entry->scheduled) {
+        ASSERT_GT(entry->expiry, now);
+        scheduled++;
+      } else if (entry->expired) {
+        ASSERT_GE(entry->expired, entry->expiry);
+      }
+    }
+    ASSERT_EQ(wheel->size(), scheduled);
+  }
+}
+
+}  // namespace
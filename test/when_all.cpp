@@ -0,0 +1,174 @@
+#include <ssh/async.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+ssh::async<int> wait(ssh::async_manual_reset_event& event, int value) {
+  co_await event;
+  co_return value;
+}
+
+ssh::async<void> wait(ssh::async_manual_reset_event& event) {
+  co_await event;
+}
+
+ssh::async<std::string> fail(ssh::async_manual_reset_event& event) {
+  co_await event;
+  throw std::runtime_error("failed");
+}
+
+ssh::task all(ssh::async<int> a, ssh::async<void> b, ssh::async<int> c, std::tuple<int, ssh::detail::void_value, int>& result, bool& done) {
+  result = co_await ssh::when_all(std::move(a), std::move(b), std::move(c));
+  done = true;
+}
+
+ssh::task all(std::vector<ssh::async<int>> tasks, std::vector<int>& result) {
+  result = co_await ssh::when_all(std::move(tasks));
+}
+
+ssh::task all(ssh::async<std::string> a, ssh::async<int> b, bool& thrown, bool& done) {
+  try {
+    co_await ssh::when_all(std::move(a), std::move(b));
+  }
+  catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  done = true;
+}
+
+ssh::task any(ssh::async<int>& a, ssh::async<int>& b, std::size_t& index, int& resumed) {
+  index = co_await ssh::when_any(a, b);
+  resumed++;
+}
+
+// Awaits the task that did not complete first.
+ssh::task any(std::vector<ssh::async<int>>& tasks, std::size_t& index, int& value) {
+  index = co_await ssh::when_any(tasks);
+  value = co_await tasks[1 - index];
+}
+
+ssh::task any_then_all(ssh::async<int>& a, ssh::async<int>& b, std::atomic_int& resumed, std::atomic_bool& done) {
+  co_await ssh::when_any(a, b);
+  resumed++;
+  co_await ssh::when_all_ready(a, b);
+  done = true;
+}
+
+TEST(when_all, resumes_with_the_results_after_all_tasks_completed) {
+  ssh::async_manual_reset_event a;
+  ssh::async_manual_reset_event b;
+  std::tuple<int, ssh::detail::void_value, int> result;
+  bool done = false;
+  all(wait(a, 1), wait(b), wait(a, 3), result, done);
+  a.set();
+  EXPECT_FALSE(done);
+  b.set();
+  EXPECT_TRUE(done);
+  EXPECT_EQ(std::get<0>(result), 1);
+  EXPECT_EQ(std::get<2>(result), 3);
+}
+
+TEST(when_all, returns_range_results_in_task_order) {
+  std::vector<ssh::async_manual_reset_event> events(8);
+  std::vector<ssh::async<int>> tasks;
+  for (std::size_t i = 0; i < events.size(); i++) {
+    tasks.push_back(wait(events[i], static_cast<int>(i)));
+  }
+  std::vector<int> result;
+  all(std::move(tasks), result);
+  for (auto i = events.size(); i > 0; i--) {
+    EXPECT_TRUE(result.empty());
+    events[i - 1].set();
+  }
+  EXPECT_EQ(result, std::vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7 }));
+}
+
+TEST(when_all, rethrows_after_all_tasks_completed) {
+  ssh::async_manual_reset_event a;
+  ssh::async_manual_reset_event b;
+  bool thrown = false;
+  bool done = false;
+  all(fail(a), wait(b, 2), thrown, done);
+  a.set();
+  EXPECT_FALSE(done);
+  b.set();
+  EXPECT_TRUE(done);
+  EXPECT_TRUE(thrown);
+}
+
+TEST(when_any, resumes_with_the_index_of_the_completed_task) {
+  ssh::async_manual_reset_event a;
+  ssh::async_manual_reset_event b;
+  auto first = wait(a, 1);
+  auto second = wait(b, 2);
+  std::size_t index = 0;
+  int resumed = 0;
+  any(first, second, index, resumed);
+  EXPECT_EQ(resumed, 0);
+  b.set();
+  EXPECT_EQ(resumed, 1);
+  EXPECT_EQ(index, 1u);
+  EXPECT_FALSE(first.is_ready());
+  // The continuation was removed from the other task, so completing it does not resume the awaiter again.
+  a.set();
+  EXPECT_EQ(resumed, 1);
+  EXPECT_TRUE(first.is_ready());
+}
+
+TEST(when_any, lets_the_other_tasks_be_awaited_afterwards) {
+  ssh::async_manual_reset_event a;
+  ssh::async_manual_reset_event b;
+  std::vector<ssh::async<int>> tasks;
+  tasks.push_back(wait(a, 1));
+  tasks.push_back(wait(b, 2));
+  std::size_t index = 0;
+  int value = 0;
+  any(tasks, index, value);
+  a.set();
+  EXPECT_EQ(index, 0u);
+  EXPECT_EQ(value, 0);
+  b.set();
+  EXPECT_EQ(value, 2);
+}
+
+TEST(when_any, does_not_suspend_when_a_task_already_completed) {
+  ssh::async_manual_reset_event a;
+  ssh::async_manual_reset_event b(true);
+  auto first = wait(a, 1);
+  auto second = wait(b, 2);
+  std::size_t index = 0;
+  int resumed = 0;
+  any(first, second, index, resumed);
+  EXPECT_EQ(resumed, 1);
+  EXPECT_EQ(index, 1u);
+  a.set();
+}
+
+TEST(when_any, resumes_once_when_tasks_complete_on_other_threads) {
+  constexpr auto rounds = 500;
+  for (auto round = 0; round < rounds; round++) {
+    ssh::async_manual_reset_event a;
+    ssh::async_manual_reset_event b;
+    auto first = wait(a, 1);
+    auto second = wait(b, 2);
+    std::atomic_int resumed = 0;
+    std::atomic_bool done = false;
+    std::thread setter_a([&]() { a.set(); });
+    std::thread setter_b([&]() { b.set(); });
+    // Registers the continuations while the tasks complete.
+    any_then_all(first, second, resumed, done);
+    setter_a.join();
+    setter_b.join();
+    ASSERT_EQ(resumed, 1);
+    ASSERT_TRUE(done);
+  }
+}
+
+}  // namespace